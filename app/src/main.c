@@ -10,7 +10,8 @@
 #include <zephyr/zbus/zbus.h>
 
 #include "xbox_controller_ble/report_structs.h"
-#include "xbox_controller_ble/hid_descr.h"
+#include "xbox_controller_ble/upsample.h"
+#include "xinput.h"
 
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/class/usb_hid.h>
@@ -24,18 +25,145 @@ ZBUS_CHAN_DECLARE(controller_connected);
 ZBUS_SUBSCRIBER_DEFINE(controller_connected_subscriber, 1);
 ZBUS_SUBSCRIBER_DEFINE(controller_report_subscriber, 1);
 
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_UPSAMPLE_LINEAR)
+#define UPSAMPLE_MODE UPSAMPLE_LINEAR
+#define UPSAMPLE_ALPHA 0
+#elif defined(CONFIG_XBOX_CONTROLLER_BLE_UPSAMPLE_FILTER)
+#define UPSAMPLE_MODE UPSAMPLE_FILTER
+#define UPSAMPLE_ALPHA CONFIG_XBOX_CONTROLLER_BLE_UPSAMPLE_FILTER_ALPHA
+#else
+#define UPSAMPLE_MODE UPSAMPLE_HOLD
+#define UPSAMPLE_ALPHA 0
+#endif
+
+static struct upsample upsampler;
+
 static enum usb_dc_status_code usb_status;
+
+/* set by the USB stack while the host is suspended, cleared on resume */
+static volatile bool usb_suspended;
+static bool wakeup_requested;
+/* cycle count of the resume or wakeup request, zero once the first report went out */
+static volatile uint32_t wake_cyc;
+/* a report published after wake_cyc was taken is in report_out */
+static bool wake_report_ready;
+static uint32_t wake_latency_max_us;
+
 static void status_cb(enum usb_dc_status_code status, const uint8_t *param)
 {
 	usb_status = status;
+
+	switch (status)
+	{
+	case USB_DC_SUSPEND:
+		usb_suspended = true;
+		wakeup_requested = false;
+		xbox_controller_ble_set_low_power(true);
+		break;
+	case USB_DC_RESUME:
+		usb_suspended = false;
+		if (!wake_cyc)
+		{
+			wake_cyc = k_cycle_get_32() | 1;
+		}
+		xbox_controller_ble_set_low_power(false);
+		break;
+	default:
+		break;
+	}
+}
+
+static void request_wakeup(void)
+{
+	int ret;
+
+	if (wakeup_requested)
+	{
+		return;
+	}
+
+	ret = usb_wakeup_request();
+	if (ret)
+	{
+		// the host did not enable remote wakeup for this device
+		LOG_DBG("Remote wakeup failed, %d", ret);
+		return;
+	}
+
+	wakeup_requested = true;
+	wake_cyc = k_cycle_get_32() | 1;
+	xbox_controller_ble_set_low_power(false);
+	LOG_INF("Remote wakeup requested");
 }
 
+static void wake_report_sent(void)
+{
+	uint32_t cyc = wake_cyc;
+
+	// a report cached from before the wake does not show the link is back
+	if (!cyc || !wake_report_ready)
+	{
+		return;
+	}
+
+	uint32_t us = (uint32_t)k_cyc_to_us_floor64(k_cycle_get_32() - cyc);
+
+	wake_cyc = 0;
+	wake_report_ready = false;
+	wakeup_requested = false;
+	wake_latency_max_us = MAX(wake_latency_max_us, us);
+	LOG_INF("First report %u us after wake (max %u us)", us, wake_latency_max_us);
+}
+
+#if defined(CONFIG_APP_USB_PERSONALITY_XINPUT)
+
+typedef xinputReport_t usb_report_t;
+
+static int usb_output_init(void)
+{
+	// the vendor interface is registered with the USB stack at build time
+	return 0;
+}
+
+static void usb_output_convert(struct xbox_controller_report const *in, usb_report_t *out)
+{
+	convert_xinput_report(in, out);
+}
+
+static void usb_output_rumble_poll(void)
+{
+	xinput_rumble_poll();
+}
+
+static int usb_output_write(const usb_report_t *report)
+{
+	return xinput_write(report);
+}
+
+#else
+
+#include "xbox_controller_ble/hid_descr.h"
+
+typedef inputReport01_t usb_report_t;
+
+static const struct device *hid_dev;
+/* set from the USB OUT callback, cleared by the main loop */
+static atomic_t rumble_pending;
+
 static void rumble_ready(const struct device *dev)
 {
 	outputReport03_t report_in = {0};
 	uint32_t ret_bytes = 0;
 	uint8_t *r = (uint8_t *)&report_in;
 	struct xbox_controller_report_output *report_out = (void *)(r + 1);
+
+	if (rumble_queue_full())
+	{
+		// leave the report in the endpoint, the host is NAKed until the queue drains
+		atomic_set(&rumble_pending, true);
+		return;
+	}
+
 	int ret = hid_int_ep_read(dev, r, sizeof(outputReport03_t), &ret_bytes);
 
 	if (!ret)
@@ -46,59 +174,67 @@ static void rumble_ready(const struct device *dev)
 	}
 }
 
-static void convert_in_report(struct xbox_controller_report const *in, inputReport01_t *out)
+static int usb_output_init(void)
+{
+	hid_dev = device_get_binding("HID_0");
+	if (hid_dev == NULL)
+	{
+		LOG_ERR("Cannot get USB HID Device");
+		return -ENODEV;
+	}
+
+	static const struct hid_ops op = {
+	    .int_out_ready = rumble_ready,
+	};
+
+	usb_hid_register_device(hid_dev,
+				hid_report_desc, sizeof(hid_report_desc),
+				&op);
+
+	return usb_hid_init(hid_dev);
+}
+
+static void usb_output_convert(struct xbox_controller_report const *in, usb_report_t *out)
+{
+	convert_in_report(in, out);
+}
+
+static void usb_output_rumble_poll(void)
+{
+	if (!rumble_queue_full() && atomic_cas(&rumble_pending, true, false))
+	{
+		rumble_ready(hid_dev);
+	}
+}
+
+static int usb_output_write(const usb_report_t *report)
 {
-	out->reportId = 1;
-	out->BTN_GamePadButton1 = in->a;
-	out->BTN_GamePadButton2 = in->b;
-	out->BTN_GamePadButton3 = in->x;
-	out->BTN_GamePadButton4 = in->y;
-	out->BTN_GamePadButton5 = in->lb;
-	out->BTN_GamePadButton6 = in->rb;
-	out->BTN_GamePadButton7 = in->select;
-	out->BTN_GamePadButton8 = in->start;
-	out->BTN_GamePadButton9 = in->system;
-	out->BTN_GamePadButton10 = in->lstick_btn;
-	out->BTN_GamePadButton11 = in->rstick_btn;
-	out->GD_GamePadX = in->lstick_x >> 8;
-	out->GD_GamePadY = in->lstick_y >> 8;
-	out->GD_GamePadZ = in->rstick_x >> 8;
-	out->GD_GamePadRx = in->rstick_y >> 8;
-	out->GD_GamePadRy = in->lt >> 2;
-	out->GD_GamePadRz = in->rt >> 2;
-	out->GD_GamePadHatSwitch = in->dpad.raw;
+	return hid_int_ep_write(hid_dev, (const uint8_t *)report, sizeof(*report), NULL);
 }
 
+#endif /* CONFIG_APP_USB_PERSONALITY_XINPUT */
+
 int main(void)
 {
 	struct xbox_controller_report report = {0};
-	inputReport01_t report_out = {0};
+	struct xbox_controller_report estimate;
+	usb_report_t report_out = {0};
 	int ret;
 
 	LOG_INF("Zephyr Example Application %s\n", APP_VERSION_STR);
 
+	upsample_init(&upsampler, UPSAMPLE_MODE, UPSAMPLE_ALPHA);
+
 	zbus_chan_add_obs(&controller_connected, &controller_connected_subscriber, K_FOREVER);
 	zbus_chan_add_obs(&controller_report, &controller_report_subscriber, K_FOREVER);
 
-	const struct device *hid_dev;
-
-	hid_dev = device_get_binding("HID_0");
-	if (hid_dev == NULL)
+	ret = usb_output_init();
+	if (ret != 0)
 	{
-		LOG_ERR("Cannot get USB HID Device");
+		LOG_ERR("Failed to set up the USB interface");
 		return -1;
 	}
 
-	struct hid_ops op = {
-	    .int_out_ready = rumble_ready,
-	};
-
-	usb_hid_register_device(hid_dev,
-				hid_report_desc, sizeof(hid_report_desc),
-				&op);
-
-	usb_hid_init(hid_dev);
-
 	ret = usb_enable(status_cb);
 	if (ret != 0)
 	{
@@ -108,19 +244,47 @@ int main(void)
 
 	while (true)
 	{
-		if (!zbus_sub_wait(&controller_report_subscriber, NULL, K_MSEC(1)))
+		usb_output_rumble_poll();
+
+		// nothing is polled while suspended, only wake up for new reports
+		bool updated = !zbus_sub_wait(&controller_report_subscriber, NULL,
+					      usb_suspended ? K_MSEC(100) : K_MSEC(1));
+		uint32_t now_us = (uint32_t)k_ticks_to_us_floor64(k_uptime_ticks());
+
+		if (updated)
 		{
 			zbus_chan_read(&controller_report, &report, K_FOREVER);
-			convert_in_report(&report, &report_out);
+			upsample_push(&upsampler, &report, now_us);
+			// checked before request_wakeup(), the report that asks for it does not count
+			wake_report_ready = wake_report_ready || (wake_cyc != 0);
+		}
+
+		if (usb_suspended)
+		{
+			if (updated && report.system)
+			{
+				request_wakeup();
+			}
+			continue;
+		}
+
+		if (updated || (UPSAMPLE_MODE != UPSAMPLE_HOLD))
+		{
+			upsample_get(&upsampler, now_us, &estimate);
+			usb_output_convert(&estimate, &report_out);
 		}
 
 		uint8_t *r = (uint8_t *)&report_out;
 		LOG_DBG("> %02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
 			r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9]);
-		ret = hid_int_ep_write(hid_dev, r, sizeof(report_out), NULL);
+		ret = usb_output_write(&report_out);
 		if (ret)
 		{
-			LOG_DBG("HID write error, %d", ret);
+			LOG_DBG("USB write error, %d", ret);
+		}
+		else
+		{
+			wake_report_sent();
 		}
 	}
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/usb/usb_device.h>
+#include <usb_descriptor.h>
+
+#include "xbox_controller_ble/xinput_descr.h"
+#include "xinput.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_DECLARE(main, CONFIG_APP_LOG_LEVEL);
+
+USBD_CLASS_DESCR_DEFINE(primary, 0) struct xinput_descriptor xinput_desc = XINPUT_DESCRIPTOR_INIT();
+
+/* set from the USB OUT callback, cleared by the main loop */
+static atomic_t rumble_pending;
+
+static void xinput_out_cb(uint8_t ep, enum usb_dc_ep_cb_status_code ep_status);
+
+static struct usb_ep_cfg_data xinput_ep_data[] = {
+	{
+		.ep_cb = usb_transfer_ep_callback,
+		.ep_addr = XINPUT_EP_IN_ADDR,
+	},
+	{
+		.ep_cb = xinput_out_cb,
+		.ep_addr = XINPUT_EP_OUT_ADDR,
+	},
+};
+
+static void rumble_read(void)
+{
+	uint8_t buf[XINPUT_EP_MPS];
+	struct xbox_controller_report_output report_out;
+	uint32_t ret_bytes = 0;
+
+	if (rumble_queue_full())
+	{
+		// leave the message in the endpoint, the host is NAKed until the queue drains
+		atomic_set(&rumble_pending, true);
+		return;
+	}
+
+	if (usb_read(xinput_ep_data[1].ep_addr, buf, sizeof(buf), &ret_bytes))
+	{
+		return;
+	}
+
+	if (!convert_xinput_rumble(buf, ret_bytes, &report_out))
+	{
+		LOG_INF("< rumble %02x %02x", buf[3], buf[4]);
+		request_rumble(&report_out);
+	}
+}
+
+static void xinput_out_cb(uint8_t ep, enum usb_dc_ep_cb_status_code ep_status)
+{
+	if (ep_status == USB_DC_EP_DATA_OUT)
+	{
+		rumble_read();
+	}
+}
+
+void xinput_rumble_poll(void)
+{
+	if (!rumble_queue_full() && atomic_cas(&rumble_pending, true, false))
+	{
+		rumble_read();
+	}
+}
+
+int xinput_write(const xinputReport_t *report)
+{
+	return usb_write(xinput_ep_data[0].ep_addr, (const uint8_t *)report, sizeof(*report), NULL);
+}
+
+static void xinput_interface_config(struct usb_desc_header *head, uint8_t bInterfaceNumber)
+{
+	ARG_UNUSED(head);
+
+	xinput_desc.if0.bInterfaceNumber = bInterfaceNumber;
+}
+
+static void xinput_status_cb(struct usb_cfg_data *cfg, enum usb_dc_status_code status,
+			     const uint8_t *param)
+{
+	ARG_UNUSED(cfg);
+	ARG_UNUSED(param);
+
+	// the endpoints were assigned in usb_enable(), the host reads the descriptors after a reset
+	if (status == USB_DC_RESET)
+	{
+		xinput_descriptor_set_endpoints(&xinput_desc, xinput_ep_data[0].ep_addr,
+						xinput_ep_data[1].ep_addr);
+	}
+}
+
+USBD_DEFINE_CFG_DATA(xinput_config) = {
+	.usb_device_description = NULL,
+	.interface_config = xinput_interface_config,
+	.interface_descriptor = &xinput_desc.if0,
+	.cb_usb_status = xinput_status_cb,
+	.interface = {
+		.class_handler = NULL,
+		.custom_handler = NULL,
+		.vendor_handler = NULL,
+	},
+	.num_endpoints = ARRAY_SIZE(xinput_ep_data),
+	.endpoint = xinput_ep_data,
+};
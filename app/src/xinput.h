@@ -0,0 +1,14 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "xbox_controller_ble/report_structs.h"
+
+#pragma once
+
+// send an input report, fails with -EAGAIN while the previous one is still queued
+int xinput_write(const xinputReport_t *report);
+
+// forward a rumble message that was held back because the BLE queue was full
+void xinput_rumble_poll(void);
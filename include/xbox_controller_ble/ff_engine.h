@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "xbox_controller_ble/report_structs.h"
+
+#pragma once
+
+#define FF_ENGINE_SLOTS 4
+// slot fed by SetEffect reports from the host, see ff_engine_set_effect()
+#define FF_ENGINE_HOST_SLOT 0
+// Magnitude[] order: left trigger, right trigger, strong, weak
+#define FF_MOTORS 4
+
+enum ff_waveform
+{
+        FF_CONSTANT,
+        FF_SQUARE,   // full level for the first half of the period, off for the second
+        FF_TRIANGLE, // off to full level and back within one period
+        FF_SAW_UP,
+        FF_SAW_DOWN,
+};
+
+// applied to every play of a looped effect, like the PID loop count repeats the whole effect
+struct ff_envelope
+{
+        uint16_t attack_ms;
+        uint8_t attack_level; // in percent of the magnitude at the start of the attack
+        uint16_t fade_ms;
+        uint8_t fade_level; // in percent of the magnitude at the end of the fade
+};
+
+struct ff_effect
+{
+        uint8_t magnitude[FF_MOTORS]; // peak level per motor, 0 to 100
+        enum ff_waveform waveform;
+        uint16_t period_ms; // ignored for FF_CONSTANT
+        uint16_t start_delay_ms;
+        uint16_t duration_ms; // length of one play, 0 plays until stopped
+        uint8_t loop_count;   // plays after the first one
+        struct ff_envelope envelope;
+};
+
+struct ff_slot
+{
+        struct ff_effect effect;
+        uint32_t start_ms;
+        bool active;
+};
+
+/*
+ * Plays effects locally and turns them into the fewest motor updates: an
+ * update is only produced when a motor level moves by at least step, starts
+ * or stops, or when the controller would stop on its own before the effects
+ * end. Every update carries the time until all effects end as its duration,
+ * so effects ending on schedule need no stop write. SetEffect reports from
+ * the host are usually streamed, each one holding until the next, so updates
+ * for them last at least min_hold_ms and the end of the stream is an
+ * explicit stop. Call ff_engine_tick() at every
+ * connection event; timestamps are in milliseconds and may wrap.
+ */
+struct ff_engine
+{
+        struct ff_slot slots[FF_ENGINE_SLOTS];
+        uint8_t sent[FF_MOTORS];
+        uint32_t sent_ms;
+        uint32_t sent_hold_ms; // the controller plays sent[] for this long after sent_ms
+        uint16_t lead_ms;
+        uint16_t min_hold_ms;
+        uint8_t step;
+};
+
+// step is the smallest level change worth a write, lead_ms how early an expiring update is renewed
+// and min_hold_ms the shortest time an update keeps the motors running
+void ff_engine_init(struct ff_engine *engine, uint8_t step, uint16_t lead_ms, uint16_t min_hold_ms);
+
+// forget everything, the controller stopped its motors with the link
+void ff_engine_reset(struct ff_engine *engine);
+
+int ff_engine_play(struct ff_engine *engine, uint8_t slot, const struct ff_effect *effect,
+                   uint32_t now_ms);
+
+int ff_engine_stop(struct ff_engine *engine, uint8_t slot);
+
+// replace the host slot with a PID SetEffect report
+void ff_engine_set_effect(struct ff_engine *engine, const struct xbox_controller_report_output *report,
+                          uint32_t now_ms);
+
+// true while an effect is pending or the motors are running
+bool ff_engine_active(const struct ff_engine *engine, uint32_t now_ms);
+
+// returns true and fills out if the controller needs an update now
+bool ff_engine_tick(struct ff_engine *engine, uint32_t now_ms, struct xbox_controller_report_output *out);
+
+// effects played by the BLE library when CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE is set,
+// slots other than FF_ENGINE_HOST_SLOT are free for the application
+int xbox_controller_ff_play(uint8_t slot, const struct ff_effect *effect);
+
+int xbox_controller_ff_stop(uint8_t slot);
@@ -4,6 +4,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #pragma once
 #pragma pack(push,1)
@@ -19,7 +20,7 @@ struct xbox_controller_report
 
         union {
                 uint8_t raw;
-                enum {
+                enum __attribute__((packed)) {
                         NEUTRAL = 0,
                         UP = 1,
                         UP_RIGHT,
@@ -65,8 +66,16 @@ struct xbox_controller_report_output
   uint8_t  LoopCount;      // Usage 0x000F007C: Loop Count, Value = 0 to 255
 };
 
+// queue a rumble write, returns -EAGAIN instead of dropping it when the queue is full
 int request_rumble(struct xbox_controller_report_output *report);
 
+// true while request_rumble() would return -EAGAIN
+bool rumble_queue_full(void);
+
+// relax scanning and dim the indicator while the USB host sleeps, safe from any context
+// the controller link is only relaxed with CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL=y
+int xbox_controller_ble_set_low_power(bool enable);
+
 //--------------------------------------------------------------------------------
 // Button Page inputReport 01 (Device --> Host)
 //--------------------------------------------------------------------------------
@@ -101,6 +110,8 @@ typedef struct
   uint8_t  : 4;                                      // Pad
 } inputReport01_t;
 
+void convert_in_report(struct xbox_controller_report const *in, inputReport01_t *out);
+
 
 //--------------------------------------------------------------------------------
 // Physical Interface Device Page outputReport 03 (Device <-- Host)
@@ -118,4 +129,60 @@ typedef struct
   uint8_t  PID_GamePadSetEffectReportLoopCount;      // Usage 0x000F007C: Loop Count, Value = 0 to 255
 } outputReport03_t;
 
-#pragma pack(pop)
\ No newline at end of file
+//--------------------------------------------------------------------------------
+// XInput input report (Device --> Host), vendor interface 0xFF/0x5D/0x01
+//--------------------------------------------------------------------------------
+
+typedef struct
+{
+  uint8_t  msgType;                                  // 0x00 = input report
+  uint8_t  msgLength;                                // 0x14 (20)
+  uint16_t buttons;                                  // XINPUT_BTN_* bit mask
+  uint8_t  leftTrigger;                              // 0 to 255
+  uint8_t  rightTrigger;                             // 0 to 255
+  int16_t  thumbLX;                                  // -32768 to 32767, right is positive
+  int16_t  thumbLY;                                  // -32768 to 32767, up is positive
+  int16_t  thumbRX;
+  int16_t  thumbRY;
+  uint8_t  reserved[6];
+} xinputReport_t;
+
+#define XINPUT_BTN_DPAD_UP     0x0001
+#define XINPUT_BTN_DPAD_DOWN   0x0002
+#define XINPUT_BTN_DPAD_LEFT   0x0004
+#define XINPUT_BTN_DPAD_RIGHT  0x0008
+#define XINPUT_BTN_START       0x0010
+#define XINPUT_BTN_BACK        0x0020
+#define XINPUT_BTN_LSTICK      0x0040
+#define XINPUT_BTN_RSTICK      0x0080
+#define XINPUT_BTN_LB          0x0100
+#define XINPUT_BTN_RB          0x0200
+#define XINPUT_BTN_GUIDE       0x0400
+#define XINPUT_BTN_A           0x1000
+#define XINPUT_BTN_B           0x2000
+#define XINPUT_BTN_X           0x4000
+#define XINPUT_BTN_Y           0x8000
+
+void convert_xinput_report(struct xbox_controller_report const *in, xinputReport_t *out);
+
+//--------------------------------------------------------------------------------
+// XInput output report (Device <-- Host)
+//--------------------------------------------------------------------------------
+
+#define XINPUT_OUT_RUMBLE 0x00
+#define XINPUT_OUT_LED    0x01
+
+typedef struct
+{
+  uint8_t  msgType;                                  // 0x00 = rumble
+  uint8_t  msgLength;                                // 0x08
+  uint8_t  reserved0;
+  uint8_t  leftMotor;                                // low frequency motor, 0 to 255
+  uint8_t  rightMotor;                               // high frequency motor, 0 to 255
+  uint8_t  reserved1[3];
+} xinputRumble_t;
+
+// translate an XInput output message, returns -ENOTSUP for messages without a rumble state
+int convert_xinput_rumble(uint8_t const *data, uint32_t length, struct xbox_controller_report_output *out);
+
+#pragma pack(pop)
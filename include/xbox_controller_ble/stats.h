@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#pragma once
+
+struct xbox_controller_ble_stats
+{
+        uint32_t reports_received;   // notifications accepted from the controller
+        uint32_t reports_published;  // reports published on controller_report (incl. heartbeats)
+        uint32_t reports_suppressed; // notifications dropped as unchanged
+        uint32_t heartbeats;         // unchanged reports published for liveness
+
+        uint32_t tx_writes;               // rumble writes handed to the stack
+        uint32_t tx_queue_depth;          // rumble writes waiting for a connection event
+        uint32_t tx_queue_peak;           // highest tx_queue_depth seen
+        uint32_t tx_backpressure;         // rumble requests refused because the queue was full
+        uint32_t tx_input_delay_events;   // input notifications delayed while rumble was sent
+        uint32_t tx_input_delay_max_us;   // longest of those delays beyond one interval
+        uint64_t tx_input_delay_total_us; // sum of those delays
+
+        uint32_t conn_transitions; // switches between fast and relaxed connection parameters
+        uint64_t conn_fast_ms;     // time connected with fast parameters
+        uint64_t conn_relaxed_ms;  // time connected with relaxed parameters
+
+        int8_t rssi;                // last RSSI of the controller link in dBm, 127 if unknown
+        uint32_t notify_gap_avg_us; // average time between input notifications
+        uint32_t notify_gap_max_us; // longest time between input notifications
+        uint32_t missed_events;     // connection events the controller did not answer, see link_quality.c
+        uint32_t crc_errors;        // CRC errors reported by the link layer
+        uint32_t chan_map_updates;  // channel maps pushed by the channel classifier
+        uint8_t chan_map[5];        // channel map in use, bit n is data channel n
+
+        uint32_t relay_notifies;         // input reports notified to the relay host
+        uint32_t relay_coalesced;        // reports replaced by a newer one before they were sent
+        uint32_t relay_rumble;           // rumble writes from the relay host
+        uint32_t relay_latency_max_us;   // longest time from controller report to relay notification sent
+        uint64_t relay_latency_total_us; // sum of those times, divide by relay_notifies
+};
+
+// published on the controller_conn_params channel whenever the link parameters change
+struct xbox_controller_conn_params
+{
+        uint16_t interval; // in 1.25 ms units
+        uint16_t latency;  // connection events the controller may skip
+        uint16_t timeout;  // supervision timeout in 10 ms units
+        bool fast;
+};
+
+int xbox_controller_ble_get_stats(struct xbox_controller_ble_stats *stats);
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "xbox_controller_ble/report_structs.h"
+
+#pragma once
+
+#define UPSAMPLE_AXES 6
+
+enum upsample_mode
+{
+        UPSAMPLE_HOLD,   // repeat the last BLE sample
+        UPSAMPLE_LINEAR, // extrapolate along the last segment, clamped to one interval
+        UPSAMPLE_FILTER, // exponential smoothing of the linear estimate, stepped per upsample_get()
+};
+
+/*
+ * Estimates stick and trigger positions between BLE samples for the 1 kHz USB
+ * side. Axes only: buttons and dpad are always taken from the last sample.
+ * Timestamps are in microseconds and may wrap.
+ */
+struct upsample
+{
+        struct xbox_controller_report last;
+        int32_t prev_axes[UPSAMPLE_AXES];
+        int32_t filtered[UPSAMPLE_AXES];
+        uint32_t last_us;
+        uint32_t interval_us;
+        enum upsample_mode mode;
+        uint16_t filter_alpha;
+        bool valid;
+};
+
+// filter_alpha is the weight of a new estimate in 1/256, only used by UPSAMPLE_FILTER
+void upsample_init(struct upsample *upsample, enum upsample_mode mode, uint16_t filter_alpha);
+
+void upsample_push(struct upsample *upsample, const struct xbox_controller_report *report,
+                   uint32_t now_us);
+
+void upsample_get(struct upsample *upsample, uint32_t now_us, struct xbox_controller_report *out);
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/drivers/usb/usb_dc.h>
+#include <zephyr/usb/usb_ch9.h>
+
+#pragma once
+
+#define XINPUT_IF_CLASS 0xFF
+#define XINPUT_IF_SUBCLASS 0x5D
+#define XINPUT_IF_PROTOCOL 0x01
+
+// requested addresses, the USB stack may assign others when it fixes up the descriptors
+#define XINPUT_EP_IN_ADDR 0x81
+#define XINPUT_EP_OUT_ADDR 0x01
+#define XINPUT_EP_MPS 32
+// poll every frame instead of the 4 ms of the original controller
+#define XINPUT_EP_IN_INTERVAL 1
+#define XINPUT_EP_OUT_INTERVAL 8
+
+/*
+ * Undocumented class specific descriptor of the wired controller's gamepad
+ * interface. The host driver only checks that it is there; it names the
+ * endpoints and the report sizes (0x14 in, 0x08 out).
+ */
+#define XINPUT_CLASS_EP_IN 4   // offset of the IN endpoint address in data[]
+#define XINPUT_CLASS_EP_OUT 11 // offset of the OUT endpoint address in data[]
+
+struct xinput_class_descriptor
+{
+        uint8_t bLength;
+        uint8_t bDescriptorType;
+        uint8_t data[15];
+} __packed;
+
+struct xinput_descriptor
+{
+        struct usb_if_descriptor if0;
+        struct xinput_class_descriptor if0_xinput;
+        struct usb_ep_descriptor if0_in_ep;
+        struct usb_ep_descriptor if0_out_ep;
+} __packed;
+
+#define XINPUT_DESCRIPTOR_INIT()                                                         \
+        {                                                                                \
+                .if0 = {                                                                 \
+                    .bLength = sizeof(struct usb_if_descriptor),                         \
+                    .bDescriptorType = USB_DESC_INTERFACE,                               \
+                    .bInterfaceNumber = 0,                                               \
+                    .bAlternateSetting = 0,                                              \
+                    .bNumEndpoints = 2,                                                  \
+                    .bInterfaceClass = XINPUT_IF_CLASS,                                  \
+                    .bInterfaceSubClass = XINPUT_IF_SUBCLASS,                            \
+                    .bInterfaceProtocol = XINPUT_IF_PROTOCOL,                            \
+                    .iInterface = 0,                                                     \
+                },                                                                       \
+                .if0_xinput = {                                                          \
+                    .bLength = sizeof(struct xinput_class_descriptor),                   \
+                    .bDescriptorType = 0x21,                                             \
+                    .data = {0x00, 0x01, 0x01, 0x25, XINPUT_EP_IN_ADDR, 0x14,            \
+                             0x00, 0x00, 0x00, 0x00, 0x13, XINPUT_EP_OUT_ADDR, 0x08,     \
+                             0x00, 0x00},                                                \
+                },                                                                       \
+                .if0_in_ep = {                                                           \
+                    .bLength = sizeof(struct usb_ep_descriptor),                         \
+                    .bDescriptorType = USB_DESC_ENDPOINT,                                \
+                    .bEndpointAddress = XINPUT_EP_IN_ADDR,                               \
+                    .bmAttributes = USB_DC_EP_INTERRUPT,                                 \
+                    .wMaxPacketSize = sys_cpu_to_le16(XINPUT_EP_MPS),                    \
+                    .bInterval = XINPUT_EP_IN_INTERVAL,                                  \
+                },                                                                       \
+                .if0_out_ep = {                                                          \
+                    .bLength = sizeof(struct usb_ep_descriptor),                         \
+                    .bDescriptorType = USB_DESC_ENDPOINT,                                \
+                    .bEndpointAddress = XINPUT_EP_OUT_ADDR,                              \
+                    .bmAttributes = USB_DC_EP_INTERRUPT,                                 \
+                    .wMaxPacketSize = sys_cpu_to_le16(XINPUT_EP_MPS),                    \
+                    .bInterval = XINPUT_EP_OUT_INTERVAL,                                 \
+                },                                                                       \
+        }
+
+// repeat the endpoint addresses assigned by the USB stack in the class descriptor
+static inline void xinput_descriptor_set_endpoints(struct xinput_descriptor *desc,
+                                                   uint8_t in_addr, uint8_t out_addr)
+{
+        desc->if0_xinput.data[XINPUT_CLASS_EP_IN] = in_addr;
+        desc->if0_xinput.data[XINPUT_CLASS_EP_OUT] = out_addr;
+}
@@ -24,6 +24,12 @@
 #include "xbox_controller_ble/report_structs.h"
 
 #include "indicator.h"
+#include "ingest.h"
+#include "scan_filter.h"
+#include "tx_sched.h"
+#include "conn_tuner.h"
+#include "link_quality.h"
+#include "relay.h"
 #include <dk_buttons_and_leds.h>
 
 LOG_MODULE_REGISTER(xbox_ble, CONFIG_XBOX_CONTROLLER_BLE_LOG_LEVEL);
@@ -43,15 +49,10 @@ uint16_t hids_report_map_attr_handle;
 uint16_t hids_report_attr_handle;
 uint16_t hids_report_write_handle;
 
-static uint8_t received_report[16];
 static bool controller_connected_value;
-
-#define NAME_LEN 30
-#define STICK_MIDDLE 32767
-
-ZBUS_CHAN_DEFINE(controller_report,
-                 struct xbox_controller_report,
-                 NULL, NULL, ZBUS_OBSERVERS_EMPTY, ZBUS_MSG_INIT(.lstick_x = STICK_MIDDLE, .lstick_y = STICK_MIDDLE, .rstick_x = STICK_MIDDLE, .rstick_y = STICK_MIDDLE));
+static bool low_power;
+static uint32_t last_notify_cyc;
+static bool notify_seen;
 
 ZBUS_CHAN_DEFINE(controller_connected, bool, NULL, NULL, ZBUS_OBSERVERS_EMPTY, false);
 
@@ -68,17 +69,32 @@ static uint8_t notify_func(struct bt_conn *conn,
                 return BT_GATT_ITER_STOP;
         }
 
-        if (length != 16)
+        int64_t rx_ms = k_uptime_get();
+        int result = report_ingest(data, length, rx_ms);
+
+        if (result == -EINVAL)
         {
                 LOG_ERR("Received report of unsupported length: %d", length);
-                return BT_GATT_ITER_CONTINUE;
         }
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL)
+        else
+        {
+                // sees every notification, whether deduplication published it or not
+                conn_tuner_on_report(rx_ms);
+        }
+#endif
 
-        memcpy(received_report, data, MIN(ARRAY_SIZE(received_report), length));
+        uint32_t now = k_cycle_get_32();
+        uint32_t gap_us = notify_seen ? k_cyc_to_us_floor32(now - last_notify_cyc) : 0;
 
-        const struct xbox_controller_report *report = data;
+        last_notify_cyc = now;
+        notify_seen = true;
 
-        zbus_chan_pub(&controller_report, report, K_NO_WAIT);
+        tx_sched_on_notify(gap_us);
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_LINK_QUALITY))
+        {
+                link_quality_on_notify(gap_us);
+        }
 
         return BT_GATT_ITER_CONTINUE;
 }
@@ -171,6 +187,7 @@ static uint8_t discover_func(struct bt_conn *conn,
                 {
                         hids_report_write_handle = bt_gatt_attr_value_handle(attr);
                         LOG_INF("hids_report_write_handle [%d]", hids_report_write_handle);
+                        tx_sched_start(conn, hids_report_write_handle);
                 }
                 if (chrc->properties & BT_GATT_CHRC_NOTIFY)
                 {
@@ -237,70 +254,38 @@ static void connect_to_device(const bt_addr_le_t *addr)
         }
 }
 
-// parse BLE ADV data and copy name into user_data
-static bool data_cb(struct bt_data *data, void *user_data)
-{
-        char *name = user_data;
-        uint8_t len;
-
-        switch (data->type)
-        {
-        case BT_DATA_NAME_SHORTENED:
-        case BT_DATA_NAME_COMPLETE:
-                len = MIN(data->data_len, NAME_LEN - 1);
-                memcpy(name, data->data, len);
-                name[len] = '\0';
-                return false;
-        default:
-                return true;
-        }
-}
-
 static void scan_recv(const struct bt_le_scan_recv_info *info,
                       struct net_buf_simple *buf)
 {
         char le_addr[BT_ADDR_LE_STR_LEN];
-        char name[NAME_LEN];
-
-        bt_addr_le_to_str(info->addr, le_addr, sizeof(le_addr));
-
-        if (bt_addr_le_is_bonded(BT_ID_DEFAULT, info->addr))
-        {
-                LOG_INF("found bonded device %s, connecting", le_addr);
-                connect_to_device(info->addr);
-                return;
-        }
 
-        if (!pairing_active)
+        // runs for every advertisement in range, the address is only formatted for a match
+        if (!scan_filter_recv(info, buf, pairing_active))
         {
                 return;
         }
 
-        /* only parse devices in close proximity */
-        if (info->rssi < -70)
-        {
-                return;
-        }
-
-        (void)memset(name, 0, sizeof(name));
-
-        bt_data_parse(buf, data_cb, name);
-
-        if (strcmp("Xbox Wireless Controller", name) == 0)
-        {
-                connect_to_device(info->addr);
-        }
+        bt_addr_le_to_str(info->addr, le_addr, sizeof(le_addr));
+        LOG_INF("found device %s, connecting", le_addr);
+        connect_to_device(info->addr);
 }
 
 static struct bt_le_scan_cb scan_callbacks = {
     .recv = scan_recv,
 };
 
+/* bonded controllers advertise on their own, a passive low duty cycle scan is enough to find them */
+static const struct bt_le_scan_param low_power_scan_param = BT_LE_SCAN_PARAM_INIT(
+    BT_LE_SCAN_TYPE_PASSIVE, BT_LE_SCAN_OPT_NONE,
+    CONFIG_XBOX_CONTROLLER_BLE_LOW_POWER_SCAN_INTERVAL,
+    CONFIG_XBOX_CONTROLLER_BLE_LOW_POWER_SCAN_WINDOW);
+
 static void start_scan(void)
 {
         int err;
+        bool relaxed = low_power && !pairing_active;
 
-        err = bt_le_scan_start(BT_LE_SCAN_ACTIVE, NULL);
+        err = bt_le_scan_start(relaxed ? &low_power_scan_param : BT_LE_SCAN_ACTIVE, NULL);
         if (err)
         {
                 LOG_ERR("Scanning failed to start (err %d)", err);
@@ -311,6 +296,10 @@ static void start_scan(void)
         {
                 set_indicator_blink_rapid();
         }
+        else if (relaxed)
+        {
+                set_indicator_dim();
+        }
         else
         {
                 set_indicator_blink_slow();
@@ -319,11 +308,46 @@ static void start_scan(void)
         LOG_INF("Scanning successfully started");
 }
 
+static void power_work_handler(struct k_work *work)
+{
+        // the connection parameters are owned by the tuner, without it the link is left as is
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL))
+        {
+                conn_tuner_set_low_power(low_power);
+        }
+
+        if (controller_connected_value)
+        {
+                if (low_power)
+                {
+                        set_indicator_dim();
+                }
+                else
+                {
+                        set_indicator_on();
+                }
+        }
+        else if (!default_conn)
+        {
+                // restart scanning with the parameters for the new state
+                bt_le_scan_stop();
+                start_scan();
+        }
+}
+
+static K_WORK_DEFINE(power_work, power_work_handler);
+
 static void connected(struct bt_conn *conn, uint8_t err)
 {
 
         char addr[BT_ADDR_LE_STR_LEN];
 
+        // the relay host connects to us, it is handled in relay.c
+        if (conn != default_conn)
+        {
+                return;
+        }
+
         bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
         if (err)
@@ -339,6 +363,21 @@ static void connected(struct bt_conn *conn, uint8_t err)
 
         LOG_INF("Connected: %s", addr);
 
+        struct bt_conn_info info;
+
+        if (!bt_conn_get_info(conn, &info))
+        {
+                tx_sched_set_interval(info.le.interval * 1250);
+                if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_LINK_QUALITY))
+                {
+                        link_quality_start(conn, info.le.interval * 1250, info.le.latency);
+                }
+                if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL))
+                {
+                        conn_tuner_start(conn, &info);
+                }
+        }
+
         // pair and bond
         err = bt_conn_set_security(conn, BT_SECURITY_L2);
         if (err && err != -EBUSY)
@@ -363,6 +402,17 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
         bt_conn_unref(default_conn);
         default_conn = NULL;
 
+        report_ingest_reset();
+        tx_sched_stop();
+        notify_seen = false;
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_LINK_QUALITY))
+        {
+                link_quality_stop();
+        }
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL))
+        {
+                conn_tuner_stop();
+        }
         controller_connected_value = false;
         zbus_chan_pub(&controller_connected, &controller_connected_value, K_NO_WAIT);
         start_scan();
@@ -372,6 +422,11 @@ static void security_changed(struct bt_conn *conn, bt_security_t level, enum bt_
 {
         int ret;
 
+        if (conn != default_conn)
+        {
+                return;
+        }
+
         if (err)
         {
                 LOG_ERR("Security failed: level %d err %d", level, err);
@@ -403,25 +458,70 @@ static void security_changed(struct bt_conn *conn, bt_security_t level, enum bt_
                         }
                         controller_connected_value = true;
                         zbus_chan_pub(&controller_connected, &controller_connected_value, K_NO_WAIT);
-                        set_indicator_on();
+                        if (low_power)
+                        {
+                                set_indicator_dim();
+                        }
+                        else
+                        {
+                                set_indicator_on();
+                        }
                 }
         }
 }
 
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+                             uint16_t latency, uint16_t timeout)
+{
+        if (conn != default_conn)
+        {
+                return;
+        }
+
+        LOG_DBG("Connection parameters updated: interval %u latency %u timeout %u",
+                interval, latency, timeout);
+        tx_sched_set_interval(interval * 1250);
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_LINK_QUALITY))
+        {
+                link_quality_set_params(interval * 1250, latency);
+        }
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL))
+        {
+                conn_tuner_on_params(interval, latency, timeout);
+        }
+}
+
 BT_CONN_CB_DEFINE(conn_callbacks) = {
     .connected = connected,
     .disconnected = disconnected,
     .security_changed = security_changed,
+    .le_param_updated = le_param_updated,
 };
 
+// the relay host connects to its own identity, the controller link uses the default one
+static bool is_relay_conn(struct bt_conn *conn)
+{
+        struct bt_conn_info info;
+
+        return IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_RELAY) && !bt_conn_get_info(conn, &info) &&
+               (info.id != BT_ID_DEFAULT);
+}
+
 static void pairing_cancel(struct bt_conn *conn)
 {
-        pairing_active = true;
+        if (!is_relay_conn(conn))
+        {
+                pairing_active = true;
+        }
 }
 
 static void pairing_confirm(struct bt_conn *conn)
 {
-        if (pairing_active)
+        if (is_relay_conn(conn))
+        {
+                relay_pairing_confirm(conn);
+        }
+        else if (pairing_active)
         {
                 bt_conn_auth_pairing_confirm(conn);
         }
@@ -438,6 +538,12 @@ static struct bt_conn_auth_cb conn_auth_callbacks = {
 
 static void pairing_complete(struct bt_conn *conn, bool bonded)
 {
+        if (is_relay_conn(conn))
+        {
+                relay_pairing_complete(conn, bonded);
+                return;
+        }
+
         LOG_INF("Pairing complete");
         pairing_active = false;
 }
@@ -445,7 +551,7 @@ static void pairing_complete(struct bt_conn *conn, bool bonded)
 static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
 {
         LOG_ERR("Pairing failed (%d), trigger disconnect", reason);
-        bt_conn_disconnect(default_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
 }
 
 struct bt_conn_auth_info_cb conn_auth_info_callbacks = {
@@ -479,6 +585,10 @@ static void button_handler(uint32_t button_state, uint32_t has_changed)
                         }
                         bt_unpair(BT_ID_DEFAULT, NULL);
                         set_indicator_blink_rapid();
+                        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_RELAY))
+                        {
+                                relay_pairing_open();
+                        }
                 }
         }
 }
@@ -489,6 +599,15 @@ static int xbox_controller_ble_init(const struct device *dev)
 
         pairing_active = true;
 
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_DEDUP)
+        report_ingest_init(true, CONFIG_XBOX_CONTROLLER_BLE_DEDUP_STICK_THRESHOLD,
+                           CONFIG_XBOX_CONTROLLER_BLE_DEDUP_TRIGGER_THRESHOLD,
+                           CONFIG_XBOX_CONTROLLER_BLE_DEDUP_HEARTBEAT_MS);
+#else
+        // nothing is suppressed, a move of one USB report step still counts as input
+        report_ingest_init(false, 256, 4, 0);
+#endif
+
         dk_buttons_init(button_handler);
 
         LOG_INF("Scan callbacks register");
@@ -523,18 +642,33 @@ static int xbox_controller_ble_init(const struct device *dev)
 
         start_scan();
 
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_RELAY))
+        {
+                err = relay_init();
+                if (err)
+                {
+                        LOG_ERR("Relay init failed (err %d)", err);
+                }
+        }
+
         return 0;
 }
 
-int request_rumble(struct xbox_controller_report_output *report)
+int xbox_controller_ble_set_low_power(bool enable)
 {
-        struct bt_conn *conn = bt_conn_ref(default_conn);
-        if (controller_connected_value && (hids_report_write_handle != 0))
+        low_power = enable;
+        k_work_submit(&power_work);
+        return 0;
+}
+
+int xbox_controller_ble_get_stats(struct xbox_controller_ble_stats *out)
+{
+        if (IS_ENABLED(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_INTERVAL))
         {
-                return bt_gatt_write_without_response(conn, hids_report_write_handle, report, sizeof(struct xbox_controller_report_output), false);
+                conn_tuner_update_stats();
         }
-        bt_conn_unref(conn);
-        return -EIO;
+        *out = xbox_ble_stats;
+        return 0;
 }
 
 SYS_INIT(xbox_controller_ble_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
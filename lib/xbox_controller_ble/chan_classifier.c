@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+
+#include "chan_classifier.h"
+
+/* weight of a new sample is 1/16 */
+#define RATE_SHIFT 4
+
+static bool map_has(const uint8_t map[CHAN_CLASSIFIER_MAP_LEN], uint8_t channel)
+{
+        return map[channel / 8] & BIT(channel % 8);
+}
+
+static void map_set(uint8_t map[CHAN_CLASSIFIER_MAP_LEN], uint8_t channel)
+{
+        map[channel / 8] |= BIT(channel % 8);
+}
+
+static void map_fill(uint8_t map[CHAN_CLASSIFIER_MAP_LEN])
+{
+        memset(map, 0xFF, CHAN_CLASSIFIER_MAP_LEN - 1);
+        map[CHAN_CLASSIFIER_MAP_LEN - 1] = 0x1F;
+}
+
+void chan_classifier_init(struct chan_classifier *cls, uint8_t bad_percent,
+                          uint16_t min_samples, uint8_t min_channels)
+{
+        memset(cls, 0, sizeof(*cls));
+        cls->bad_rate = (uint32_t)bad_percent * CHAN_CLASSIFIER_RATE_ONE / 100;
+        cls->min_samples = min_samples;
+        cls->min_channels = CLAMP(min_channels, 2, CHAN_CLASSIFIER_CHANNELS);
+        map_fill(cls->map);
+}
+
+void chan_classifier_record(struct chan_classifier *cls, uint8_t channel, bool crc_error)
+{
+        if (channel >= CHAN_CLASSIFIER_CHANNELS)
+        {
+                return;
+        }
+
+        int32_t rate = cls->error_rate[channel];
+        int32_t sample = crc_error ? CHAN_CLASSIFIER_RATE_ONE : 0;
+
+        cls->error_rate[channel] = rate + (sample - rate) / (1 << RATE_SHIFT);
+        if (cls->samples[channel] < UINT16_MAX)
+        {
+                cls->samples[channel]++;
+        }
+}
+
+bool chan_classifier_update(struct chan_classifier *cls)
+{
+        uint8_t map[CHAN_CLASSIFIER_MAP_LEN] = {0};
+        bool bad[CHAN_CLASSIFIER_CHANNELS];
+        int good = 0;
+
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                // excluded channels keep their verdict until recovered
+                bad[ch] = !map_has(cls->map, ch) ||
+                          ((cls->samples[ch] >= cls->min_samples) && (cls->error_rate[ch] > cls->bad_rate));
+                good += !bad[ch];
+        }
+
+        // keep the least bad channels to stay above the minimum
+        while (good < cls->min_channels)
+        {
+                int best = -1;
+
+                for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+                {
+                        if (bad[ch] && ((best < 0) || (cls->error_rate[ch] < cls->error_rate[best])))
+                        {
+                                best = ch;
+                        }
+                }
+                bad[best] = false;
+                good++;
+        }
+
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                if (!bad[ch])
+                {
+                        map_set(map, ch);
+                }
+        }
+
+        if (memcmp(map, cls->map, sizeof(map)) == 0)
+        {
+                return false;
+        }
+
+        memcpy(cls->map, map, sizeof(map));
+        return true;
+}
+
+void chan_classifier_recover(struct chan_classifier *cls)
+{
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                if (!map_has(cls->map, ch))
+                {
+                        cls->error_rate[ch] = 0;
+                        cls->samples[ch] = 0;
+                }
+        }
+        map_fill(cls->map);
+}
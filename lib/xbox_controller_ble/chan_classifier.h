@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#pragma once
+
+#define CHAN_CLASSIFIER_CHANNELS 37
+#define CHAN_CLASSIFIER_MAP_LEN 5
+
+/* error rates are kept as an exponential average in 1/4096 */
+#define CHAN_CLASSIFIER_RATE_ONE 4096
+
+/*
+ * Classifies BLE data channels by their CRC error rate in connection events.
+ * Channels above the threshold are left out of the channel map, but never so
+ * many that fewer than min_channels remain; the least bad ones are kept.
+ */
+struct chan_classifier
+{
+        uint16_t error_rate[CHAN_CLASSIFIER_CHANNELS];
+        uint16_t samples[CHAN_CLASSIFIER_CHANNELS];
+        uint8_t map[CHAN_CLASSIFIER_MAP_LEN];
+        uint16_t bad_rate;
+        uint16_t min_samples;
+        uint8_t min_channels;
+};
+
+void chan_classifier_init(struct chan_classifier *cls, uint8_t bad_percent,
+                          uint16_t min_samples, uint8_t min_channels);
+
+// one connection event on the given data channel
+void chan_classifier_record(struct chan_classifier *cls, uint8_t channel, bool crc_error);
+
+// recompute the channel map, returns true if it changed
+bool chan_classifier_update(struct chan_classifier *cls);
+
+// give excluded channels another chance, they get no samples while excluded
+void chan_classifier_recover(struct chan_classifier *cls);
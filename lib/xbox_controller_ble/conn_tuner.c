@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/zbus/zbus.h>
+#include <zephyr/bluetooth/conn.h>
+
+#include "xbox_controller_ble/stats.h"
+
+#include "conn_tuner.h"
+#include "ingest.h"
+#include "report_filter.h"
+
+LOG_MODULE_DECLARE(xbox_ble, CONFIG_XBOX_CONTROLLER_BLE_LOG_LEVEL);
+
+/*
+ * Input activity switches the link to the shortest interval without
+ * peripheral latency right away. Only after
+ * CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_IDLE_MS without activity, and never
+ * sooner than CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_HOLDOFF_MS after the last
+ * request, it relaxes to the long interval with peripheral latency.
+ *
+ * The input is active while it moves or is held outside the deadzones. Moves
+ * are tracked by ingest on every notification, with or without deduplication,
+ * and the held check reads its last report in place, nothing is copied here.
+ *
+ * conn_tuner_on_report() runs in the Bluetooth RX thread and the rest on the
+ * system work queue, the state shared between them is atomic.
+ */
+
+ZBUS_CHAN_DEFINE(controller_conn_params, struct xbox_controller_conn_params,
+                 NULL, NULL, ZBUS_OBSERVERS_EMPTY, ZBUS_MSG_INIT(0));
+
+static const struct bt_le_conn_param fast_params = BT_LE_CONN_PARAM_INIT(
+    CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_FAST_INTERVAL,
+    CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_FAST_INTERVAL,
+    0, CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_TIMEOUT);
+
+static const struct bt_le_conn_param relaxed_params = BT_LE_CONN_PARAM_INIT(
+    CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_RELAXED_INTERVAL,
+    CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_RELAXED_INTERVAL,
+    CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_RELAXED_LATENCY,
+    CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_TIMEOUT);
+
+static void tuner_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(tuner_work, tuner_work_handler);
+
+static struct bt_conn *tuner_conn;
+static atomic_t want_fast;
+static bool requested_fast;
+static bool requested;
+static atomic_t low_power;
+// uptime in ms truncated to 32 bit, only ever compared by difference
+static atomic_t last_active_ms;
+static int64_t last_request_ms;
+static int64_t mode_since_ms;
+static struct xbox_controller_conn_params current;
+
+static bool params_fast(uint16_t interval, uint16_t latency)
+{
+        return (interval <= CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_FAST_INTERVAL) && (latency == 0);
+}
+
+static void tuner_work_handler(struct k_work *work)
+{
+        int64_t now = k_uptime_get();
+        bool fast = atomic_get(&want_fast);
+        int err;
+
+        if (!tuner_conn || (requested && (requested_fast == fast)))
+        {
+                return;
+        }
+
+        // going fast is never delayed, relaxing respects the holdoff
+        if (!fast && requested && (now - last_request_ms < CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_HOLDOFF_MS))
+        {
+                k_work_reschedule(&tuner_work,
+                                  K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_HOLDOFF_MS - (now - last_request_ms)));
+                return;
+        }
+
+        err = bt_conn_le_param_update(tuner_conn, fast ? &fast_params : &relaxed_params);
+        if (err)
+        {
+                LOG_WRN("Connection parameter update failed (err %d)", err);
+                k_work_reschedule(&tuner_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_HOLDOFF_MS));
+                return;
+        }
+
+        LOG_DBG("Requested %s connection parameters", fast ? "fast" : "relaxed");
+        requested = true;
+        requested_fast = fast;
+        last_request_ms = now;
+}
+
+static void account_mode(int64_t now)
+{
+        if (current.fast)
+        {
+                xbox_ble_stats.conn_fast_ms += now - mode_since_ms;
+        }
+        else
+        {
+                xbox_ble_stats.conn_relaxed_ms += now - mode_since_ms;
+        }
+        mode_since_ms = now;
+}
+
+void conn_tuner_start(struct bt_conn *conn, const struct bt_conn_info *info)
+{
+        conn_tuner_stop();
+
+        tuner_conn = bt_conn_ref(conn);
+        requested = false;
+        mode_since_ms = k_uptime_get();
+        atomic_set(&last_active_ms, (atomic_val_t)mode_since_ms);
+
+        current.interval = info->le.interval;
+        current.latency = info->le.latency;
+        current.timeout = info->le.timeout;
+        current.fast = params_fast(info->le.interval, info->le.latency);
+        zbus_chan_pub(&controller_conn_params, &current, K_NO_WAIT);
+
+        // a fresh link is about to be used, start fast unless the host sleeps
+        atomic_set(&want_fast, !atomic_get(&low_power));
+        k_work_reschedule(&tuner_work, K_NO_WAIT);
+}
+
+void conn_tuner_stop(void)
+{
+        k_work_cancel_delayable(&tuner_work);
+
+        if (tuner_conn)
+        {
+                account_mode(k_uptime_get());
+                bt_conn_unref(tuner_conn);
+                tuner_conn = NULL;
+        }
+}
+
+void conn_tuner_on_report(int64_t now)
+{
+        bool active;
+
+        if (atomic_get(&low_power))
+        {
+                return;
+        }
+
+        // ingest marked a move at this very notification, or the last moved report is held
+        active = (report_ingest_last_change() == now) ||
+                 report_is_active(report_ingest_last(),
+                                  CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_STICK_DEADZONE,
+                                  CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_TRIGGER_DEADZONE);
+
+        if (active)
+        {
+                atomic_set(&last_active_ms, (atomic_val_t)now);
+                if (!atomic_set(&want_fast, true))
+                {
+                        k_work_reschedule(&tuner_work, K_NO_WAIT);
+                }
+        }
+        else if (((uint32_t)now - (uint32_t)atomic_get(&last_active_ms) >=
+                  CONFIG_XBOX_CONTROLLER_BLE_ADAPTIVE_IDLE_MS) &&
+                 atomic_cas(&want_fast, true, false))
+        {
+                k_work_reschedule(&tuner_work, K_NO_WAIT);
+        }
+}
+
+void conn_tuner_set_low_power(bool enable)
+{
+        atomic_set(&low_power, enable);
+
+        // relax right away when the host sleeps, be ready for input once it wakes up
+        atomic_set(&want_fast, !enable);
+        atomic_set(&last_active_ms, (atomic_val_t)k_uptime_get());
+        k_work_reschedule(&tuner_work, K_NO_WAIT);
+}
+
+void conn_tuner_on_params(uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+        int64_t now = k_uptime_get();
+        bool fast = params_fast(interval, latency);
+
+        account_mode(now);
+
+        if (fast != current.fast)
+        {
+                xbox_ble_stats.conn_transitions++;
+        }
+
+        current.interval = interval;
+        current.latency = latency;
+        current.timeout = timeout;
+        current.fast = fast;
+        zbus_chan_pub(&controller_conn_params, &current, K_NO_WAIT);
+}
+
+void conn_tuner_update_stats(void)
+{
+        if (tuner_conn)
+        {
+                account_mode(k_uptime_get());
+        }
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <zephyr/bluetooth/conn.h>
+
+#pragma once
+
+// take over connection parameter management for a new link
+void conn_tuner_start(struct bt_conn *conn, const struct bt_conn_info *info);
+
+void conn_tuner_stop(void);
+
+// called for every input notification right after report_ingest() with the same timestamp,
+// whether deduplication published it or not
+void conn_tuner_on_report(int64_t now);
+
+// hold the relaxed parameters regardless of activity, e.g. while the USB host sleeps
+void conn_tuner_set_low_power(bool enable);
+
+// the link layer applied new connection parameters
+void conn_tuner_on_params(uint16_t interval, uint16_t latency, uint16_t timeout);
+
+// add the time spent in the current mode so far to the statistics
+void conn_tuner_update_stats(void);
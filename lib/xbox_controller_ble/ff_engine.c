@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+
+#include "xbox_controller_ble/ff_engine.h"
+
+#define LEVEL_MAX 100
+/* gains are in 1/256 */
+#define GAIN_ONE 256
+/* longest a single write keeps the motors running: 255 x 10 ms, 256 loops */
+#define HOLD_UNIT_MS 10
+#define HOLD_MAX_MS (255 * HOLD_UNIT_MS * 256)
+
+// DC Enable Actuators bit of Magnitude[motor]: weak 0x01, strong 0x02, right 0x04, left 0x08
+#define MOTOR_BIT(motor) BIT(FF_MOTORS - 1 - (motor))
+
+static uint32_t play_length(const struct ff_effect *effect)
+{
+        return (uint32_t)effect->duration_ms * (effect->loop_count + 1);
+}
+
+static uint32_t level_to_gain(uint8_t level)
+{
+        return MIN(level, LEVEL_MAX) * GAIN_ONE / LEVEL_MAX;
+}
+
+static uint32_t envelope_gain(const struct ff_effect *effect, uint32_t t)
+{
+        const struct ff_envelope *env = &effect->envelope;
+        uint32_t gain = GAIN_ONE;
+
+        if (env->attack_ms && t < env->attack_ms)
+        {
+                uint32_t start = level_to_gain(env->attack_level);
+
+                gain = start + (GAIN_ONE - start) * t / env->attack_ms;
+        }
+
+        if (effect->duration_ms && env->fade_ms && t + env->fade_ms > effect->duration_ms)
+        {
+                uint32_t end = level_to_gain(env->fade_level);
+                uint32_t left = effect->duration_ms - t;
+
+                gain = MIN(gain, end + (GAIN_ONE - end) * left / env->fade_ms);
+        }
+
+        return gain;
+}
+
+static uint32_t wave_gain(const struct ff_effect *effect, uint32_t t)
+{
+        uint32_t period = effect->period_ms;
+        uint32_t phase;
+
+        if (effect->waveform == FF_CONSTANT || period == 0)
+        {
+                return GAIN_ONE;
+        }
+
+        phase = t % period;
+
+        switch (effect->waveform)
+        {
+        case FF_SQUARE:
+                return (phase < period / 2) ? GAIN_ONE : 0;
+        case FF_TRIANGLE:
+                return (phase < period / 2) ? 2 * GAIN_ONE * phase / period
+                                            : 2 * GAIN_ONE * (period - phase) / period;
+        case FF_SAW_UP:
+                return GAIN_ONE * phase / period;
+        case FF_SAW_DOWN:
+                return GAIN_ONE * (period - phase) / period;
+        default:
+                return GAIN_ONE;
+        }
+}
+
+/*
+ * Motor levels of all effects at now_ms. hold_ms is set to the time until
+ * every effect that is playing has ended, HOLD_MAX_MS for endless ones.
+ * Host reports only hold until the next one; if one is playing, the hold is
+ * extended to min_hold_ms.
+ */
+static bool mix(const struct ff_engine *engine, uint32_t now_ms, uint8_t level[FF_MOTORS],
+                uint32_t *hold_ms)
+{
+        uint32_t sum[FF_MOTORS] = {0};
+        uint32_t hold = 0;
+        bool on = false;
+        bool host = false;
+
+        for (size_t i = 0; i < FF_ENGINE_SLOTS; i++)
+        {
+                const struct ff_slot *slot = &engine->slots[i];
+                const struct ff_effect *effect = &slot->effect;
+                uint32_t elapsed = now_ms - slot->start_ms;
+
+                if (!slot->active || elapsed < effect->start_delay_ms)
+                {
+                        continue;
+                }
+
+                uint32_t t = elapsed - effect->start_delay_ms;
+                uint32_t length = play_length(effect);
+
+                if (effect->duration_ms && t >= length)
+                {
+                        continue;
+                }
+
+                hold = MAX(hold, effect->duration_ms ? length - t : HOLD_MAX_MS);
+                host |= (i == FF_ENGINE_HOST_SLOT);
+
+                // position within the current loop, the envelope restarts with every loop
+                t = effect->duration_ms ? t % effect->duration_ms : t;
+
+                uint32_t gain = envelope_gain(effect, t) * wave_gain(effect, t) / GAIN_ONE;
+
+                for (size_t m = 0; m < FF_MOTORS; m++)
+                {
+                        sum[m] += (MIN(effect->magnitude[m], LEVEL_MAX) * gain + GAIN_ONE / 2) / GAIN_ONE;
+                }
+        }
+
+        for (size_t m = 0; m < FF_MOTORS; m++)
+        {
+                level[m] = MIN(sum[m], LEVEL_MAX);
+                on |= (level[m] != 0);
+        }
+        if (host)
+        {
+                // renewing a short update every few events costs more than one stop write
+                hold = MAX(hold, engine->min_hold_ms);
+        }
+        *hold_ms = MIN(hold, HOLD_MAX_MS);
+
+        return on;
+}
+
+static void retire_slots(struct ff_engine *engine, uint32_t now_ms)
+{
+        for (size_t i = 0; i < FF_ENGINE_SLOTS; i++)
+        {
+                struct ff_slot *slot = &engine->slots[i];
+                const struct ff_effect *effect = &slot->effect;
+
+                if (slot->active && effect->duration_ms &&
+                    (now_ms - slot->start_ms) >= effect->start_delay_ms + play_length(effect))
+                {
+                        slot->active = false;
+                }
+        }
+}
+
+static bool motors_running(const struct ff_engine *engine, uint32_t now_ms)
+{
+        return (now_ms - engine->sent_ms) < engine->sent_hold_ms;
+}
+
+void ff_engine_init(struct ff_engine *engine, uint8_t step, uint16_t lead_ms, uint16_t min_hold_ms)
+{
+        memset(engine, 0, sizeof(*engine));
+        engine->step = MAX(step, 1);
+        engine->lead_ms = lead_ms;
+        engine->min_hold_ms = min_hold_ms;
+}
+
+void ff_engine_reset(struct ff_engine *engine)
+{
+        ff_engine_init(engine, engine->step, engine->lead_ms, engine->min_hold_ms);
+}
+
+int ff_engine_play(struct ff_engine *engine, uint8_t slot, const struct ff_effect *effect,
+                   uint32_t now_ms)
+{
+        if (slot >= FF_ENGINE_SLOTS)
+        {
+                return -EINVAL;
+        }
+
+        engine->slots[slot].effect = *effect;
+        engine->slots[slot].start_ms = now_ms;
+        engine->slots[slot].active = true;
+
+        return 0;
+}
+
+int ff_engine_stop(struct ff_engine *engine, uint8_t slot)
+{
+        if (slot >= FF_ENGINE_SLOTS)
+        {
+                return -EINVAL;
+        }
+
+        engine->slots[slot].active = false;
+
+        return 0;
+}
+
+void ff_engine_set_effect(struct ff_engine *engine, const struct xbox_controller_report_output *report,
+                          uint32_t now_ms)
+{
+        struct ff_effect effect = {
+            .waveform = FF_CONSTANT,
+            .start_delay_ms = report->StartDelay * HOLD_UNIT_MS,
+            .duration_ms = report->Duration * HOLD_UNIT_MS,
+            .loop_count = report->LoopCount,
+        };
+        bool on = false;
+
+        for (size_t m = 0; m < FF_MOTORS; m++)
+        {
+                effect.magnitude[m] = (report->DcEnableActuators & MOTOR_BIT(m)) ? report->Magnitude[m] : 0;
+                on |= (effect.magnitude[m] != 0);
+        }
+
+        // a zero duration plays nothing on the controller either
+        if (!on || report->Duration == 0)
+        {
+                ff_engine_stop(engine, FF_ENGINE_HOST_SLOT);
+                return;
+        }
+
+        ff_engine_play(engine, FF_ENGINE_HOST_SLOT, &effect, now_ms);
+}
+
+bool ff_engine_active(const struct ff_engine *engine, uint32_t now_ms)
+{
+        for (size_t i = 0; i < FF_ENGINE_SLOTS; i++)
+        {
+                if (engine->slots[i].active)
+                {
+                        return true;
+                }
+        }
+
+        return motors_running(engine, now_ms);
+}
+
+bool ff_engine_tick(struct ff_engine *engine, uint32_t now_ms, struct xbox_controller_report_output *out)
+{
+        uint8_t level[FF_MOTORS];
+        uint32_t hold;
+        bool running = motors_running(engine, now_ms);
+        uint32_t left = running ? engine->sent_hold_ms - (now_ms - engine->sent_ms) : 0;
+        bool update = false;
+
+        retire_slots(engine, now_ms);
+        bool on = mix(engine, now_ms, level, &hold);
+
+        for (size_t m = 0; m < FF_MOTORS; m++)
+        {
+                int playing = running ? engine->sent[m] : 0;
+                int diff = level[m] - playing;
+
+                if (level[m] == 0 && playing != 0)
+                {
+                        // no stop write when the controller stops on its own shortly
+                        update |= (left > engine->lead_ms);
+                }
+                else if ((level[m] != 0 && playing == 0) || (diff >= engine->step) ||
+                         (-diff >= engine->step))
+                {
+                        // starting a motor is always sent, small level changes are not
+                        update = true;
+                }
+        }
+
+        // the controller stops soon, renew the update if the effects go on past that point
+        if (!update && on && running)
+        {
+                uint8_t later[FF_MOTORS];
+                uint32_t later_hold;
+
+                update = (left <= engine->lead_ms) &&
+                         mix(engine, engine->sent_ms + engine->sent_hold_ms, later, &later_hold);
+        }
+
+        if (!update)
+        {
+                return false;
+        }
+
+        memset(out, 0, sizeof(*out));
+        for (size_t m = 0; m < FF_MOTORS; m++)
+        {
+                out->Magnitude[m] = level[m];
+                out->DcEnableActuators |= level[m] ? MOTOR_BIT(m) : 0;
+        }
+
+        if (!on)
+        {
+                hold = 0;
+        }
+        else if (hold <= 255 * HOLD_UNIT_MS)
+        {
+                // rounded up, the controller overruns the end by less than one unit
+                out->Duration = DIV_ROUND_UP(hold, HOLD_UNIT_MS);
+        }
+        else
+        {
+                out->Duration = 255;
+                out->LoopCount = MIN(hold / (255 * HOLD_UNIT_MS), 256) - 1;
+                hold = 255 * HOLD_UNIT_MS * (out->LoopCount + 1);
+        }
+
+        memcpy(engine->sent, level, sizeof(level));
+        engine->sent_ms = now_ms;
+        engine->sent_hold_ms = hold;
+
+        return true;
+}
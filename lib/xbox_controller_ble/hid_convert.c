@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "xbox_controller_ble/report_structs.h"
+
+// longest a single rumble write plays: 255 x 10 ms, repeated 255 more times, about 11 minutes
+#define RUMBLE_HOLD_DURATION 0xFF
+#define RUMBLE_HOLD_LOOP_COUNT 0xFF
+
+void convert_in_report(struct xbox_controller_report const *in, inputReport01_t *out)
+{
+        out->reportId = 1;
+        out->BTN_GamePadButton1 = in->a;
+        out->BTN_GamePadButton2 = in->b;
+        out->BTN_GamePadButton3 = in->x;
+        out->BTN_GamePadButton4 = in->y;
+        out->BTN_GamePadButton5 = in->lb;
+        out->BTN_GamePadButton6 = in->rb;
+        out->BTN_GamePadButton7 = in->select;
+        out->BTN_GamePadButton8 = in->start;
+        out->BTN_GamePadButton9 = in->system;
+        out->BTN_GamePadButton10 = in->lstick_btn;
+        out->BTN_GamePadButton11 = in->rstick_btn;
+        out->GD_GamePadX = in->lstick_x >> 8;
+        out->GD_GamePadY = in->lstick_y >> 8;
+        out->GD_GamePadZ = in->rstick_x >> 8;
+        out->GD_GamePadRx = in->rstick_y >> 8;
+        out->GD_GamePadRy = in->lt >> 2;
+        out->GD_GamePadRz = in->rt >> 2;
+        out->GD_GamePadHatSwitch = in->dpad.raw;
+}
+
+// hat switch value to XInput dpad bits, NEUTRAL and out of range values map to none
+static const uint8_t xinput_dpad[] = {
+    [UP] = XINPUT_BTN_DPAD_UP,
+    [UP_RIGHT] = XINPUT_BTN_DPAD_UP | XINPUT_BTN_DPAD_RIGHT,
+    [RIGHT] = XINPUT_BTN_DPAD_RIGHT,
+    [DOWN_RIGHT] = XINPUT_BTN_DPAD_DOWN | XINPUT_BTN_DPAD_RIGHT,
+    [DOWN] = XINPUT_BTN_DPAD_DOWN,
+    [DOWN_LEFT] = XINPUT_BTN_DPAD_DOWN | XINPUT_BTN_DPAD_LEFT,
+    [LEFT] = XINPUT_BTN_DPAD_LEFT,
+    [UP_LEFT] = XINPUT_BTN_DPAD_UP | XINPUT_BTN_DPAD_LEFT,
+};
+
+void convert_xinput_report(struct xbox_controller_report const *in, xinputReport_t *out)
+{
+        uint16_t buttons = 0;
+
+        if (in->dpad.raw < sizeof(xinput_dpad))
+        {
+                buttons = xinput_dpad[in->dpad.raw];
+        }
+        buttons |= in->start ? XINPUT_BTN_START : 0;
+        buttons |= in->select ? XINPUT_BTN_BACK : 0;
+        buttons |= in->lstick_btn ? XINPUT_BTN_LSTICK : 0;
+        buttons |= in->rstick_btn ? XINPUT_BTN_RSTICK : 0;
+        buttons |= in->lb ? XINPUT_BTN_LB : 0;
+        buttons |= in->rb ? XINPUT_BTN_RB : 0;
+        buttons |= in->system ? XINPUT_BTN_GUIDE : 0;
+        buttons |= in->a ? XINPUT_BTN_A : 0;
+        buttons |= in->b ? XINPUT_BTN_B : 0;
+        buttons |= in->x ? XINPUT_BTN_X : 0;
+        buttons |= in->y ? XINPUT_BTN_Y : 0;
+
+        out->msgType = 0x00;
+        out->msgLength = sizeof(xinputReport_t);
+        out->buttons = buttons;
+        // 10 bit triggers
+        out->leftTrigger = in->lt >> 2;
+        out->rightTrigger = in->rt >> 2;
+        // unsigned sticks with y pointing down, XInput is signed with y pointing up
+        out->thumbLX = (int16_t)(in->lstick_x - 32768);
+        out->thumbLY = (int16_t)(32767 - in->lstick_y);
+        out->thumbRX = (int16_t)(in->rstick_x - 32768);
+        out->thumbRY = (int16_t)(32767 - in->rstick_y);
+        for (size_t i = 0; i < sizeof(out->reserved); i++)
+        {
+                out->reserved[i] = 0;
+        }
+}
+
+int convert_xinput_rumble(uint8_t const *data, uint32_t length, struct xbox_controller_report_output *out)
+{
+        xinputRumble_t const *rumble = (xinputRumble_t const *)data;
+
+        if (length < sizeof(xinputRumble_t) || rumble->msgType != XINPUT_OUT_RUMBLE)
+        {
+                // LED patterns and anything else the controller cannot show
+                return -ENOTSUP;
+        }
+
+        // strong and weak motor only, the impulse triggers are not reachable through XInput
+        out->DcEnableActuators = 0x3;
+        out->Magnitude[0] = 0;
+        out->Magnitude[1] = 0;
+        out->Magnitude[2] = (rumble->leftMotor * 100 + 127) / 255;
+        out->Magnitude[3] = (rumble->rightMotor * 100 + 127) / 255;
+        // XInput sets a level that holds until the next message, play it for the longest time possible
+        out->Duration = RUMBLE_HOLD_DURATION;
+        out->StartDelay = 0;
+        out->LoopCount = RUMBLE_HOLD_LOOP_COUNT;
+
+        return 0;
+}
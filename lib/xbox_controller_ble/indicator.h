@@ -2,3 +2,4 @@ void set_indicator_on();
 void set_indicator_off();
 void set_indicator_blink_rapid();
 void set_indicator_blink_slow();
+void set_indicator_dim();
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/zbus/zbus.h>
+
+#include "ingest.h"
+#include "report_filter.h"
+
+#define STICK_MIDDLE 32767
+
+ZBUS_CHAN_DEFINE(controller_report,
+                 struct xbox_controller_report,
+                 NULL, NULL, ZBUS_OBSERVERS_EMPTY, ZBUS_MSG_INIT(.lstick_x = STICK_MIDDLE, .lstick_y = STICK_MIDDLE, .rstick_x = STICK_MIDDLE, .rstick_y = STICK_MIDDLE));
+
+struct xbox_controller_ble_stats xbox_ble_stats;
+
+static struct report_filter received_report;
+static bool dedup_enabled;
+static int64_t last_change;
+
+void report_ingest_init(bool dedup, uint16_t stick_threshold,
+                        uint16_t trigger_threshold, uint32_t heartbeat_ms)
+{
+        dedup_enabled = dedup;
+        report_filter_init(&received_report, stick_threshold, trigger_threshold, heartbeat_ms);
+}
+
+void report_ingest_reset(void)
+{
+        report_filter_reset(&received_report);
+}
+
+int report_ingest(const void *data, uint16_t length, int64_t now)
+{
+        int result = REPORT_FILTER_CHANGED;
+
+        if (length != sizeof(struct xbox_controller_report))
+        {
+                return -EINVAL;
+        }
+
+        xbox_ble_stats.reports_received++;
+
+        // the filter tracks moves with or without deduplication
+        result = report_filter_check(&received_report, data, now);
+        if (result == REPORT_FILTER_CHANGED)
+        {
+                last_change = now;
+        }
+
+        if (!dedup_enabled)
+        {
+                zbus_chan_pub(&controller_report, data, K_NO_WAIT);
+                xbox_ble_stats.reports_published++;
+                return REPORT_FILTER_CHANGED;
+        }
+
+        switch (result)
+        {
+        case REPORT_FILTER_DROP:
+                xbox_ble_stats.reports_suppressed++;
+                return result;
+        case REPORT_FILTER_HEARTBEAT:
+                xbox_ble_stats.heartbeats++;
+                break;
+        default:
+                break;
+        }
+
+        zbus_chan_pub(&controller_report, &received_report.last.report, K_NO_WAIT);
+        xbox_ble_stats.reports_published++;
+
+        return result;
+}
+
+const struct xbox_controller_report *report_ingest_last(void)
+{
+        return &received_report.last.report;
+}
+
+int64_t report_ingest_last_change(void)
+{
+        return last_change;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "xbox_controller_ble/stats.h"
+
+#pragma once
+
+extern struct xbox_controller_ble_stats xbox_ble_stats;
+
+// the thresholds define a move of the input; with dedup only moves and heartbeats are
+// published, without it every notification is
+void report_ingest_init(bool dedup, uint16_t stick_threshold,
+                        uint16_t trigger_threshold, uint32_t heartbeat_ms);
+
+// forget the last report, e.g. after the controller disconnected
+void report_ingest_reset(void);
+
+// filter a raw notification and publish it on controller_report
+// returns a report_filter_result or -EINVAL for a report of unsupported length
+int report_ingest(const void *data, uint16_t length, int64_t now);
+
+// last report that moved, word aligned and valid until the next call to report_ingest()
+// with dedup this is also the last published report
+const struct xbox_controller_report *report_ingest_last(void);
+
+// uptime in ms of the last notification that moved the input by more than the
+// thresholds, repeated notifications and noise do not count
+int64_t report_ingest_last_change(void);
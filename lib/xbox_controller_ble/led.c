@@ -15,43 +15,64 @@
 
 #define FREQ_FAST K_MSEC(125)
 #define FREQ_SLOW K_MSEC(1000)
+#define DIM_ON K_MSEC(20)
+#define DIM_OFF K_MSEC(2000)
 
-static k_timeout_t blink_freq;
+static k_timeout_t blink_on;
+static k_timeout_t blink_off;
+static bool led_state;
 
 static void led_work_handler(struct k_work *work);
 static K_WORK_DELAYABLE_DEFINE(led_work, led_work_handler);
 static const struct gpio_dt_spec indicator_led = GPIO_DT_SPEC_GET(DT_ALIAS(led_indicator), gpios);
 
+static void led_set(bool on)
+{
+        led_state = on;
+        gpio_pin_set_dt(&indicator_led, on);
+}
+
 static void led_work_handler(struct k_work *work)
 {
-        gpio_pin_toggle_dt(&indicator_led);
-        k_work_reschedule(&led_work, blink_freq);
+        led_set(!led_state);
+        k_work_reschedule(&led_work, led_state ? blink_on : blink_off);
 }
 
 void set_indicator_on()
 {
         k_work_cancel_delayable(&led_work);
-        gpio_pin_set_dt(&indicator_led, 1);
+        led_set(1);
 }
 void set_indicator_off()
 {
         k_work_cancel_delayable(&led_work);
-        gpio_pin_set_dt(&indicator_led, 0);
+        led_set(0);
 }
 void set_indicator_blink_rapid()
 {
-        blink_freq = FREQ_FAST;
-        k_work_reschedule(&led_work, blink_freq);
+        blink_on = FREQ_FAST;
+        blink_off = FREQ_FAST;
+        k_work_reschedule(&led_work, blink_on);
 }
 void set_indicator_blink_slow()
 {
-        blink_freq = FREQ_SLOW;
-        k_work_reschedule(&led_work, blink_freq);
+        blink_on = FREQ_SLOW;
+        blink_off = FREQ_SLOW;
+        k_work_reschedule(&led_work, blink_on);
+}
+// short flash every two seconds while the USB host sleeps
+void set_indicator_dim()
+{
+        blink_on = DIM_ON;
+        blink_off = DIM_OFF;
+        led_set(0);
+        k_work_reschedule(&led_work, blink_off);
 }
 
 static int indicator_init(const struct device *dev)
 {
         gpio_pin_configure_dt(&indicator_led, GPIO_OUTPUT_HIGH);
+        led_state = true;
         return 0;
 }
 SYS_INIT(indicator_init, APPLICATION, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
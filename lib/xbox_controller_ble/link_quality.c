@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/hci.h>
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_CLASSIFIER)
+#include <sdc_hci_vs.h>
+#include "chan_classifier.h"
+#endif
+
+#include "ingest.h"
+#include "link_quality.h"
+
+LOG_MODULE_DECLARE(xbox_ble, CONFIG_XBOX_CONTROLLER_BLE_LOG_LEVEL);
+
+#define RSSI_UNKNOWN 127
+
+static void rssi_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(rssi_work, rssi_work_handler);
+
+static struct bt_conn *lq_conn;
+static uint16_t lq_handle;
+static uint32_t interval_us;
+static uint16_t peripheral_latency;
+// missed events come from the QoS reports, not from notification gaps
+static bool qos_reports;
+
+static void rssi_work_handler(struct k_work *work)
+{
+        struct bt_hci_cp_read_rssi *cp;
+        struct bt_hci_rp_read_rssi *rp;
+        struct net_buf *buf, *rsp = NULL;
+        int err;
+
+        if (!lq_conn)
+        {
+                return;
+        }
+
+        buf = bt_hci_cmd_create(BT_HCI_OP_READ_RSSI, sizeof(*cp));
+        if (buf)
+        {
+                cp = net_buf_add(buf, sizeof(*cp));
+                cp->handle = sys_cpu_to_le16(lq_handle);
+
+                err = bt_hci_cmd_send_sync(BT_HCI_OP_READ_RSSI, buf, &rsp);
+                if (err)
+                {
+                        LOG_DBG("Read RSSI failed (err %d)", err);
+                }
+                else
+                {
+                        rp = (void *)rsp->data;
+                        xbox_ble_stats.rssi = rp->rssi;
+                        net_buf_unref(rsp);
+                }
+        }
+
+        k_work_reschedule(&rssi_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_LINK_RSSI_INTERVAL_MS));
+}
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_CLASSIFIER)
+
+/*
+ * The SoftDevice Controller reports the data channel and the CRC errors of
+ * every connection event. Channels that keep failing are left out of the
+ * host channel classification; they are given another chance periodically
+ * since the link layer stops using them and no new samples arrive. An event
+ * in which nothing was received intact from the controller is counted as
+ * missed.
+ */
+
+static struct chan_classifier classifier;
+static int64_t last_recovery_ms;
+
+static void chan_map_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(chan_map_work, chan_map_work_handler);
+
+static bool on_vs_evt(struct net_buf_simple *buf)
+{
+        sdc_hci_subevent_vs_qos_conn_event_report_t *evt;
+
+        if (net_buf_simple_pull_u8(buf) != SDC_HCI_SUBEVENT_VS_QOS_CONN_EVENT_REPORT)
+        {
+                return false;
+        }
+
+        evt = (void *)buf->data;
+        if (!lq_conn || (sys_le16_to_cpu(evt->conn_handle) != lq_handle))
+        {
+                return true;
+        }
+
+        xbox_ble_stats.crc_errors += evt->crc_error_count;
+        chan_classifier_record(&classifier, evt->channel_index, evt->crc_error_count != 0);
+
+        if ((peripheral_latency == 0) &&
+            (evt->rx_timeout || ((evt->crc_error_count != 0) && (evt->rx_packet_count == 0))))
+        {
+                xbox_ble_stats.missed_events++;
+        }
+
+        return true;
+}
+
+static int qos_report_enable(bool enable)
+{
+        sdc_hci_cmd_vs_qos_conn_event_report_enable_t *cp;
+        struct net_buf *buf;
+
+        buf = bt_hci_cmd_create(SDC_HCI_OPCODE_CMD_VS_QOS_CONN_EVENT_REPORT_ENABLE, sizeof(*cp));
+        if (!buf)
+        {
+                return -ENOBUFS;
+        }
+
+        cp = net_buf_add(buf, sizeof(*cp));
+        cp->enable = enable;
+
+        return bt_hci_cmd_send_sync(SDC_HCI_OPCODE_CMD_VS_QOS_CONN_EVENT_REPORT_ENABLE, buf, NULL);
+}
+
+static void chan_map_work_handler(struct k_work *work)
+{
+        int64_t now = k_uptime_get();
+        int err;
+
+        if (!lq_conn)
+        {
+                return;
+        }
+
+        if (now - last_recovery_ms >= CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_RECOVERY_MS)
+        {
+                chan_classifier_recover(&classifier);
+                last_recovery_ms = now;
+        }
+
+        if (chan_classifier_update(&classifier))
+        {
+                err = bt_le_set_chan_map(classifier.map);
+                if (err)
+                {
+                        LOG_WRN("Setting channel map failed (err %d)", err);
+                }
+                else
+                {
+                        LOG_INF("Channel map %02x%02x%02x%02x%02x", classifier.map[4], classifier.map[3],
+                                classifier.map[2], classifier.map[1], classifier.map[0]);
+                        xbox_ble_stats.chan_map_updates++;
+                }
+        }
+        memcpy(xbox_ble_stats.chan_map, classifier.map, sizeof(xbox_ble_stats.chan_map));
+
+        k_work_reschedule(&chan_map_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_MAP_INTERVAL_MS));
+}
+
+static void classifier_start(void)
+{
+        static bool registered;
+        int err;
+
+        if (!registered)
+        {
+                err = bt_hci_register_vnd_evt_cb(on_vs_evt);
+                if (err)
+                {
+                        LOG_ERR("Failed to register vendor event callback (err %d)", err);
+                        return;
+                }
+                registered = true;
+        }
+
+        chan_classifier_init(&classifier, CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_BAD_PERCENT,
+                             CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_MIN_SAMPLES,
+                             CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_MIN_COUNT);
+        last_recovery_ms = k_uptime_get();
+
+        err = qos_report_enable(true);
+        if (err)
+        {
+                LOG_ERR("Failed to enable QoS reports (err %d)", err);
+                return;
+        }
+        qos_reports = true;
+
+        k_work_reschedule(&chan_map_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_MAP_INTERVAL_MS));
+}
+
+static void classifier_stop(void)
+{
+        k_work_cancel_delayable(&chan_map_work);
+        (void)qos_report_enable(false);
+        qos_reports = false;
+
+        // the host channel classification outlives the link, start the next one clean
+        chan_classifier_recover(&classifier);
+        (void)bt_le_set_chan_map(classifier.map);
+}
+
+#endif /* CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_CLASSIFIER */
+
+void link_quality_start(struct bt_conn *conn, uint32_t interval, uint16_t latency)
+{
+        link_quality_stop();
+
+        if (bt_hci_get_conn_handle(conn, &lq_handle))
+        {
+                return;
+        }
+
+        lq_conn = bt_conn_ref(conn);
+        interval_us = interval;
+        peripheral_latency = latency;
+        xbox_ble_stats.rssi = RSSI_UNKNOWN;
+
+        k_work_reschedule(&rssi_work, K_NO_WAIT);
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_CLASSIFIER)
+        classifier_start();
+#endif
+}
+
+void link_quality_stop(void)
+{
+        if (!lq_conn)
+        {
+                return;
+        }
+
+        k_work_cancel_delayable(&rssi_work);
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_CHANNEL_CLASSIFIER)
+        classifier_stop();
+#endif
+
+        bt_conn_unref(lq_conn);
+        lq_conn = NULL;
+}
+
+void link_quality_set_params(uint32_t interval, uint16_t latency)
+{
+        interval_us = interval;
+        peripheral_latency = latency;
+}
+
+void link_quality_on_notify(uint32_t gap_us)
+{
+        if (gap_us == 0)
+        {
+                return;
+        }
+
+        xbox_ble_stats.notify_gap_max_us = MAX(xbox_ble_stats.notify_gap_max_us, gap_us);
+        xbox_ble_stats.notify_gap_avg_us += ((int32_t)gap_us - (int32_t)xbox_ble_stats.notify_gap_avg_us) / 16;
+
+        // without QoS reports, every interval without a notification is taken as a lost or
+        // retransmitted connection event
+        if (!qos_reports && (peripheral_latency == 0) && (interval_us != 0) &&
+            (gap_us > interval_us + interval_us / 2))
+        {
+                xbox_ble_stats.missed_events += (gap_us + interval_us / 2) / interval_us - 1;
+        }
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+
+#include <zephyr/bluetooth/conn.h>
+
+#pragma once
+
+void link_quality_start(struct bt_conn *conn, uint32_t interval_us, uint16_t latency);
+
+void link_quality_stop(void);
+
+// events the controller may skip under peripheral latency are not counted as missed
+void link_quality_set_params(uint32_t interval_us, uint16_t latency);
+
+// an input notification arrived, gap_us is the time since the previous one
+void link_quality_on_notify(uint32_t gap_us);
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/zbus/zbus.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "xbox_controller_ble/hid_descr.h"
+
+#include "ingest.h"
+#include "relay.h"
+
+LOG_MODULE_DECLARE(xbox_ble, CONFIG_XBOX_CONTROLLER_BLE_LOG_LEVEL);
+
+BUILD_ASSERT(CONFIG_BT_ID_MAX > 1, "the relay needs its own identity");
+BUILD_ASSERT(CONFIG_BT_MAX_CONN > 1, "the relay needs a second connection");
+
+ZBUS_CHAN_DECLARE(controller_report);
+
+/*
+ * HID-over-GATT peripheral that re-broadcasts the controller with the same
+ * report map and mapping as the USB HID path. It advertises from its own
+ * identity so the bonded host is never mistaken for a controller by the
+ * scanner. At most one input notification is handed to the stack at a time;
+ * reports arriving meanwhile overwrite the pending one, so a report waits at
+ * most one relay connection event instead of queueing behind stale ones.
+ */
+
+#define INPUT_REPORT_ID 0x01
+#define OUTPUT_REPORT_ID 0x03
+
+#define HIDS_REMOTE_WAKE BIT(0)
+#define HIDS_NORMALLY_CONNECTABLE BIT(1)
+
+enum
+{
+        RELAY_IN_FLIGHT,
+        RELAY_DIRTY,
+};
+
+struct hids_info
+{
+        uint16_t version; // bcdHID
+        uint8_t code;     // country code
+        uint8_t flags;
+} __packed;
+
+struct hids_report
+{
+        uint8_t id;
+        uint8_t type;
+} __packed;
+
+static const struct hids_info info = {
+    .version = 0x0111,
+    .code = 0x00,
+    .flags = HIDS_NORMALLY_CONNECTABLE,
+};
+
+static const struct hids_report input_ref = {
+    .id = INPUT_REPORT_ID,
+    .type = 0x01,
+};
+
+static const struct hids_report output_ref = {
+    .id = OUTPUT_REPORT_ID,
+    .type = 0x02,
+};
+
+static struct bt_conn *relay_conn;
+// a new host may pair, open until one bonded to the relay identity
+static bool relay_pairing;
+static uint8_t relay_id;
+static bool notify_enabled;
+static atomic_t relay_flags;
+
+// latest converted report and when it arrived, and the one notified last, guarded by report_lock
+static struct k_spinlock report_lock;
+static inputReport01_t pending_report;
+static uint32_t pending_cyc;
+static uint32_t sent_cyc;
+// written under the lock by the relay work item only, which may read it without
+static inputReport01_t sent_report;
+
+static struct xbox_controller_report_output last_rumble;
+static struct bt_gatt_notify_params notify_params;
+
+static const struct bt_data ad[] = {
+    BT_DATA_BYTES(BT_DATA_GAP_APPEARANCE,
+                  (CONFIG_BT_DEVICE_APPEARANCE >> 0) & 0xff,
+                  (CONFIG_BT_DEVICE_APPEARANCE >> 8) & 0xff),
+    BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+    BT_DATA_BYTES(BT_DATA_UUID16_ALL, BT_UUID_16_ENCODE(BT_UUID_HIDS_VAL)),
+};
+
+static const struct bt_data sd[] = {
+    BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, sizeof(CONFIG_BT_DEVICE_NAME) - 1),
+};
+
+static ssize_t read_info(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                         void *buf, uint16_t len, uint16_t offset)
+{
+        return bt_gatt_attr_read(conn, attr, buf, len, offset, attr->user_data,
+                                 sizeof(struct hids_info));
+}
+
+static ssize_t read_report_map(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                               void *buf, uint16_t len, uint16_t offset)
+{
+        return bt_gatt_attr_read(conn, attr, buf, len, offset, hid_report_desc,
+                                 sizeof(hid_report_desc));
+}
+
+static ssize_t read_report_ref(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                               void *buf, uint16_t len, uint16_t offset)
+{
+        return bt_gatt_attr_read(conn, attr, buf, len, offset, attr->user_data,
+                                 sizeof(struct hids_report));
+}
+
+static ssize_t read_input_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                 void *buf, uint16_t len, uint16_t offset)
+{
+        k_spinlock_key_t key = k_spin_lock(&report_lock);
+        inputReport01_t report = sent_report;
+
+        k_spin_unlock(&report_lock, key);
+
+        // the report id is carried by the report reference descriptor
+        return bt_gatt_attr_read(conn, attr, buf, len, offset, (uint8_t *)&report + 1,
+                                 sizeof(report) - 1);
+}
+
+static ssize_t read_output_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                  void *buf, uint16_t len, uint16_t offset)
+{
+        return bt_gatt_attr_read(conn, attr, buf, len, offset, &last_rumble,
+                                 sizeof(last_rumble));
+}
+
+static ssize_t write_output_report(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                   const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+        struct xbox_controller_report_output report;
+
+        if (offset != 0 || len != sizeof(report))
+        {
+                return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+        }
+
+        memcpy(&report, buf, sizeof(report));
+        if (request_rumble(&report))
+        {
+                // same backpressure as the USB path, the host retries the write
+                return BT_GATT_ERR(BT_ATT_ERR_INSUFFICIENT_RESOURCES);
+        }
+
+        last_rumble = report;
+        xbox_ble_stats.relay_rumble++;
+
+        return len;
+}
+
+static ssize_t write_ctrl_point(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+                                const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+        // suspend and exit suspend need no action, notifications only flow while subscribed
+        return len;
+}
+
+static void input_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+        notify_enabled = (value == BT_GATT_CCC_NOTIFY);
+        LOG_INF("Relay notifications %s", notify_enabled ? "enabled" : "disabled");
+}
+
+BT_GATT_SERVICE_DEFINE(relay_svc,
+                       BT_GATT_PRIMARY_SERVICE(BT_UUID_HIDS),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_INFO, BT_GATT_CHRC_READ,
+                                              BT_GATT_PERM_READ, read_info, NULL, (void *)&info),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT_MAP, BT_GATT_CHRC_READ,
+                                              BT_GATT_PERM_READ_ENCRYPT, read_report_map, NULL, NULL),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+                                              BT_GATT_PERM_READ_ENCRYPT, read_input_report, NULL, NULL),
+                       BT_GATT_CCC(input_ccc_changed,
+                                   BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+                       BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ_ENCRYPT,
+                                          read_report_ref, NULL, (void *)&input_ref),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT,
+                                              BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE |
+                                                  BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                                              BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT,
+                                              read_output_report, write_output_report, NULL),
+                       BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ_ENCRYPT,
+                                          read_report_ref, NULL, (void *)&output_ref),
+                       BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_CTRL_POINT, BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                                              BT_GATT_PERM_WRITE, NULL, write_ctrl_point, NULL), );
+
+// value attribute of the input report characteristic
+#define INPUT_REPORT_ATTR (&relay_svc.attrs[6])
+
+static void relay_work_handler(struct k_work *work);
+static K_WORK_DEFINE(relay_work, relay_work_handler);
+
+static void relay_sent(struct bt_conn *conn, void *user_data)
+{
+        uint32_t us = (uint32_t)k_cyc_to_us_floor64(k_cycle_get_32() - sent_cyc);
+
+        xbox_ble_stats.relay_latency_max_us = MAX(xbox_ble_stats.relay_latency_max_us, us);
+        xbox_ble_stats.relay_latency_total_us += us;
+
+        atomic_clear_bit(&relay_flags, RELAY_IN_FLIGHT);
+        if (atomic_test_and_clear_bit(&relay_flags, RELAY_DIRTY) &&
+            !atomic_test_and_set_bit(&relay_flags, RELAY_IN_FLIGHT))
+        {
+                k_work_submit(&relay_work);
+        }
+}
+
+static void relay_work_handler(struct k_work *work)
+{
+        k_spinlock_key_t key = k_spin_lock(&report_lock);
+        int err;
+
+        sent_report = pending_report;
+        sent_cyc = pending_cyc;
+        k_spin_unlock(&report_lock, key);
+
+        if (!relay_conn || !notify_enabled)
+        {
+                atomic_clear_bit(&relay_flags, RELAY_IN_FLIGHT);
+                return;
+        }
+
+        notify_params.attr = INPUT_REPORT_ATTR;
+        notify_params.data = (uint8_t *)&sent_report + 1;
+        notify_params.len = sizeof(sent_report) - 1;
+        notify_params.func = relay_sent;
+
+        err = bt_gatt_notify_cb(relay_conn, &notify_params);
+        if (err)
+        {
+                LOG_DBG("Relay notify failed (err %d)", err);
+                atomic_clear_bit(&relay_flags, RELAY_IN_FLIGHT);
+                return;
+        }
+        xbox_ble_stats.relay_notifies++;
+}
+
+static void relay_report_cb(const struct zbus_channel *chan)
+{
+        const struct xbox_controller_report *report = zbus_chan_const_msg(chan);
+        k_spinlock_key_t key;
+
+        if (!relay_conn || !notify_enabled)
+        {
+                return;
+        }
+
+        key = k_spin_lock(&report_lock);
+        convert_in_report(report, &pending_report);
+        pending_cyc = k_cycle_get_32();
+        k_spin_unlock(&report_lock, key);
+
+        atomic_set_bit(&relay_flags, RELAY_DIRTY);
+        if (!atomic_test_and_set_bit(&relay_flags, RELAY_IN_FLIGHT))
+        {
+                atomic_clear_bit(&relay_flags, RELAY_DIRTY);
+                k_work_submit(&relay_work);
+        }
+        else
+        {
+                xbox_ble_stats.relay_coalesced++;
+        }
+}
+
+ZBUS_LISTENER_DEFINE(relay_listener, relay_report_cb);
+
+static int relay_adv_start(void)
+{
+        // advertising stops once a host connected, a second host cannot take the controller's slot
+        struct bt_le_adv_param param = BT_LE_ADV_PARAM_INIT(BT_LE_ADV_OPT_CONNECTABLE |
+                                                                 BT_LE_ADV_OPT_ONE_TIME,
+                                                             BT_GAP_ADV_FAST_INT_MIN_2,
+                                                             BT_GAP_ADV_FAST_INT_MAX_2, NULL);
+        int err;
+
+        param.id = relay_id;
+        err = bt_le_adv_start(&param, ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+        if (err)
+        {
+                LOG_ERR("Relay advertising failed to start (err %d)", err);
+        }
+
+        return err;
+}
+
+static void adv_work_handler(struct k_work *work)
+{
+        relay_adv_start();
+}
+
+static K_WORK_DEFINE(adv_work, adv_work_handler);
+
+static void relay_connected(struct bt_conn *conn, uint8_t err)
+{
+        struct bt_conn_info info;
+
+        if (err || bt_conn_get_info(conn, &info) || info.role != BT_CONN_ROLE_PERIPHERAL ||
+            info.id != relay_id)
+        {
+                return;
+        }
+
+        if (relay_conn)
+        {
+                // only one relay host is served, keep the existing one
+                err = bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+                if (err)
+                {
+                        LOG_WRN("Extra relay host not disconnected (err %d)", err);
+                }
+                return;
+        }
+
+        LOG_INF("Relay host connected");
+        relay_conn = bt_conn_ref(conn);
+        atomic_clear(&relay_flags);
+
+        // fastest interval the host allows, a relayed report waits at most one of them
+        err = bt_conn_le_param_update(conn, BT_LE_CONN_PARAM(CONFIG_XBOX_CONTROLLER_BLE_RELAY_INTERVAL,
+                                                             CONFIG_XBOX_CONTROLLER_BLE_RELAY_INTERVAL,
+                                                             0, CONFIG_XBOX_CONTROLLER_BLE_RELAY_TIMEOUT));
+        if (err)
+        {
+                LOG_WRN("Relay parameter update failed (err %d)", err);
+        }
+
+        err = bt_conn_set_security(conn, BT_SECURITY_L2);
+        if (err && err != -EBUSY)
+        {
+                LOG_WRN("Relay security failed (err %d)", err);
+                err = bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+                if (err)
+                {
+                        LOG_WRN("Relay host not disconnected (err %d)", err);
+                }
+        }
+}
+
+static void relay_disconnected(struct bt_conn *conn, uint8_t reason)
+{
+        if (conn != relay_conn)
+        {
+                return;
+        }
+
+        LOG_INF("Relay host disconnected (reason 0x%02x)", reason);
+        bt_conn_unref(relay_conn);
+        relay_conn = NULL;
+        notify_enabled = false;
+        // advertising stopped when the host connected, restart it outside the callback
+        k_work_submit(&adv_work);
+}
+
+static void relay_bond_found(const struct bt_bond_info *info, void *user_data)
+{
+        relay_pairing = false;
+}
+
+void relay_pairing_open(void)
+{
+        int err;
+
+        // the relay identity keeps a single bond, so a new host never needs the controller's key slot
+        err = bt_unpair(relay_id, NULL);
+        if (err)
+        {
+                LOG_WRN("Removing the relay bond failed (err %d)", err);
+        }
+        relay_pairing = true;
+}
+
+void relay_pairing_confirm(struct bt_conn *conn)
+{
+        if (relay_pairing)
+        {
+                bt_conn_auth_pairing_confirm(conn);
+        }
+        else
+        {
+                bt_conn_auth_cancel(conn);
+        }
+}
+
+void relay_pairing_complete(struct bt_conn *conn, bool bonded)
+{
+        LOG_INF("Relay host paired");
+        if (bonded)
+        {
+                relay_pairing = false;
+        }
+}
+
+BT_CONN_CB_DEFINE(relay_conn_callbacks) = {
+    .connected = relay_connected,
+    .disconnected = relay_disconnected,
+};
+
+int relay_init(void)
+{
+        bt_addr_le_t addrs[CONFIG_BT_ID_MAX];
+        size_t count = ARRAY_SIZE(addrs);
+        int err;
+
+        // the identity is stored with the bonds, reuse it after a reboot
+        bt_id_get(addrs, &count);
+        if (count > 1)
+        {
+                relay_id = 1;
+        }
+        else
+        {
+                err = bt_id_create(NULL, NULL);
+                if (err < 0)
+                {
+                        LOG_ERR("Relay identity creation failed (err %d)", err);
+                        return err;
+                }
+                relay_id = err;
+        }
+
+        // the first host pairs without pressing a button
+        relay_pairing = true;
+        bt_foreach_bond(relay_id, relay_bond_found, NULL);
+
+        err = zbus_chan_add_obs(&controller_report, &relay_listener, K_MSEC(100));
+        if (err)
+        {
+                LOG_ERR("Relay observer registration failed (err %d)", err);
+                return err;
+        }
+
+        err = relay_adv_start();
+        if (err)
+        {
+                return err;
+        }
+
+        LOG_INF("Relay advertising on identity %u", relay_id);
+
+        return 0;
+}
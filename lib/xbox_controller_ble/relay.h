@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <zephyr/bluetooth/conn.h>
+
+#pragma once
+
+// start advertising the HID-over-GATT relay, call after settings_load()
+int relay_init(void);
+
+// forget the relay host and accept a new one until it has bonded, e.g. when pairing mode
+// was entered; a connected relay host is disconnected
+void relay_pairing_open(void);
+
+// pairing callbacks for the relay identity, they leave the controller's pairing mode alone
+void relay_pairing_confirm(struct bt_conn *conn);
+void relay_pairing_complete(struct bt_conn *conn, bool bonded);
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/toolchain.h>
+#include <zephyr/sys/util.h>
+
+#include "report_filter.h"
+
+BUILD_ASSERT(sizeof(struct xbox_controller_report) == 16, "unexpected report size");
+
+/* words 0 and 1 hold the sticks, word 2 the triggers, word 3 dpad and buttons */
+#define TRIGGER_WORD 2
+#define BUTTON_WORD 3
+
+#define STICK_MIDDLE 32767
+
+void report_filter_init(struct report_filter *filter, uint16_t stick_threshold,
+                        uint16_t trigger_threshold, uint32_t heartbeat_ms)
+{
+        memset(filter, 0, sizeof(*filter));
+        filter->stick_threshold = stick_threshold;
+        filter->trigger_threshold = trigger_threshold;
+        filter->heartbeat_ms = heartbeat_ms;
+}
+
+void report_filter_reset(struct report_filter *filter)
+{
+        filter->valid = false;
+}
+
+// check both 16 bit axes packed into one word against the noise threshold
+static bool axes_moved(uint32_t a, uint32_t b, uint16_t threshold)
+{
+        int32_t lo = (int32_t)(a & 0xFFFF) - (int32_t)(b & 0xFFFF);
+        int32_t hi = (int32_t)(a >> 16) - (int32_t)(b >> 16);
+
+        return (abs(lo) > threshold) || (abs(hi) > threshold);
+}
+
+enum report_filter_result report_filter_check(struct report_filter *filter,
+                                              const uint8_t *data, int64_t now)
+{
+        uint32_t words[4];
+        bool changed = !filter->valid;
+
+        // BLE buffers are not guaranteed to be aligned
+        memcpy(words, data, sizeof(words));
+
+        for (size_t i = 0; (i < ARRAY_SIZE(words)) && !changed; i++)
+        {
+                if (words[i] == filter->last.words[i])
+                {
+                        continue;
+                }
+
+                if (i == BUTTON_WORD)
+                {
+                        changed = true;
+                }
+                else
+                {
+                        changed = axes_moved(words[i], filter->last.words[i],
+                                             (i == TRIGGER_WORD) ? filter->trigger_threshold
+                                                                 : filter->stick_threshold);
+                }
+        }
+
+        if (changed)
+        {
+                memcpy(filter->last.words, words, sizeof(words));
+                filter->last_publish = now;
+                filter->valid = true;
+                return REPORT_FILTER_CHANGED;
+        }
+
+        if ((filter->heartbeat_ms != 0) && (now - filter->last_publish >= filter->heartbeat_ms))
+        {
+                filter->last_publish = now;
+                return REPORT_FILTER_HEARTBEAT;
+        }
+
+        return REPORT_FILTER_DROP;
+}
+
+static bool stick_active(uint16_t value, uint16_t deadzone)
+{
+        return abs((int32_t)value - STICK_MIDDLE) > deadzone;
+}
+
+bool report_is_active(const struct xbox_controller_report *report,
+                      uint16_t stick_deadzone, uint16_t trigger_deadzone)
+{
+        return stick_active(report->lstick_x, stick_deadzone) ||
+               stick_active(report->lstick_y, stick_deadzone) ||
+               stick_active(report->rstick_x, stick_deadzone) ||
+               stick_active(report->rstick_y, stick_deadzone) ||
+               (report->lt > trigger_deadzone) || (report->rt > trigger_deadzone) ||
+               (report->dpad.raw != NEUTRAL) ||
+               report->a || report->b || report->x || report->y || report->lb || report->rb ||
+               report->select || report->start || report->system ||
+               report->lstick_btn || report->rstick_btn;
+}
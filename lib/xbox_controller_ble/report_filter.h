@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "xbox_controller_ble/report_structs.h"
+
+#pragma once
+
+enum report_filter_result
+{
+        REPORT_FILTER_DROP,
+        REPORT_FILTER_CHANGED,
+        REPORT_FILTER_HEARTBEAT,
+};
+
+/* last accepted report, kept word-aligned so it can be compared word by word */
+struct report_filter
+{
+        union {
+                struct xbox_controller_report report;
+                uint32_t words[4];
+        } last;
+        int64_t last_publish;
+        uint32_t heartbeat_ms;
+        uint16_t stick_threshold;
+        uint16_t trigger_threshold;
+        bool valid;
+};
+
+void report_filter_init(struct report_filter *filter, uint16_t stick_threshold,
+                        uint16_t trigger_threshold, uint32_t heartbeat_ms);
+
+// forget the last accepted report so the next one is always published
+void report_filter_reset(struct report_filter *filter);
+
+// compare a raw 16 byte report against the last accepted one, updating it on change
+// the heartbeat is only due from a call, there is no timer behind it
+enum report_filter_result report_filter_check(struct report_filter *filter,
+                                              const uint8_t *data, int64_t now);
+
+// true while a stick or trigger is outside its deadzone or any button is held
+bool report_is_active(const struct xbox_controller_report *report,
+                      uint16_t stick_deadzone, uint16_t trigger_deadzone);
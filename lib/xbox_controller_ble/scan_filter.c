@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/bluetooth/gap.h>
+
+#include "scan_filter.h"
+
+static const char controller_name[] = "Xbox Wireless Controller";
+
+// walk the AD structures in place and compare the name without copying it
+bool scan_filter_match(int8_t rssi, const uint8_t *data, uint16_t len)
+{
+        if (rssi < SCAN_FILTER_MIN_RSSI)
+        {
+                return false;
+        }
+
+        while (len > 1)
+        {
+                uint8_t field_len = data[0];
+
+                if ((field_len == 0) || (field_len >= len))
+                {
+                        return false;
+                }
+
+                uint8_t type = data[1];
+
+                if ((type == BT_DATA_NAME_COMPLETE) || (type == BT_DATA_NAME_SHORTENED))
+                {
+                        return ((field_len - 1) == (sizeof(controller_name) - 1)) &&
+                               (memcmp(&data[2], controller_name, sizeof(controller_name) - 1) == 0);
+                }
+
+                data += field_len + 1;
+                len -= field_len + 1;
+        }
+
+        return false;
+}
+
+bool scan_filter_recv(const struct bt_le_scan_recv_info *info, const struct net_buf_simple *buf,
+                      bool pairing)
+{
+        if (bt_addr_le_is_bonded(BT_ID_DEFAULT, info->addr))
+        {
+                return true;
+        }
+
+        return pairing && scan_filter_match(info->rssi, buf->data, buf->len);
+}
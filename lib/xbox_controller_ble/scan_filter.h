@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/net/buf.h>
+
+#pragma once
+
+// only devices in close proximity are considered for pairing
+#define SCAN_FILTER_MIN_RSSI -70
+
+// check whether raw advertising data belongs to an unbonded controller in pairing range
+bool scan_filter_match(int8_t rssi, const uint8_t *data, uint16_t len);
+
+// body of the scan callback: bonded devices are always connected, controllers in range only
+// while pairing is active
+bool scan_filter_recv(const struct bt_le_scan_recv_info *info, const struct net_buf_simple *buf,
+                      bool pairing);
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/shell/shell.h>
+
+#include "xbox_controller_ble/stats.h"
+
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv)
+{
+        struct xbox_controller_ble_stats stats;
+
+        xbox_controller_ble_get_stats(&stats);
+
+        shell_print(sh, "reports: received %u, published %u, suppressed %u, heartbeats %u",
+                    stats.reports_received, stats.reports_published,
+                    stats.reports_suppressed, stats.heartbeats);
+        shell_print(sh, "rumble: writes %u, queued %u (peak %u), backpressure %u",
+                    stats.tx_writes, stats.tx_queue_depth, stats.tx_queue_peak, stats.tx_backpressure);
+        shell_print(sh, "rumble input delay: %u events, max %u us, total %llu us",
+                    stats.tx_input_delay_events, stats.tx_input_delay_max_us,
+                    stats.tx_input_delay_total_us);
+        shell_print(sh, "interval: %u transitions, fast %llu ms, relaxed %llu ms",
+                    stats.conn_transitions, stats.conn_fast_ms, stats.conn_relaxed_ms);
+        shell_print(sh, "link: rssi %d dBm, gap avg %u us, max %u us, missed events %u",
+                    stats.rssi, stats.notify_gap_avg_us, stats.notify_gap_max_us,
+                    stats.missed_events);
+        shell_print(sh, "channels: crc errors %u, map updates %u, map %02x%02x%02x%02x%02x",
+                    stats.crc_errors, stats.chan_map_updates, stats.chan_map[4], stats.chan_map[3],
+                    stats.chan_map[2], stats.chan_map[1], stats.chan_map[0]);
+        shell_print(sh, "relay: notifies %u, coalesced %u, rumble %u, latency max %u us, total %llu us",
+                    stats.relay_notifies, stats.relay_coalesced, stats.relay_rumble,
+                    stats.relay_latency_max_us, stats.relay_latency_total_us);
+
+        return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(xbox_cmds,
+                               SHELL_CMD(stats, NULL, "Print pipeline and link statistics", cmd_stats),
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(xbox, &xbox_cmds, "XBOX controller commands", NULL);
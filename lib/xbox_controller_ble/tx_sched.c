@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "xbox_controller_ble/ff_engine.h"
+
+#include "ingest.h"
+#include "tx_sched.h"
+
+LOG_MODULE_DECLARE(xbox_ble, CONFIG_XBOX_CONTROLLER_BLE_LOG_LEVEL);
+
+/*
+ * Rumble writes are queued and only sent right after an input notification,
+ * at most CONFIG_XBOX_CONTROLLER_BLE_TX_PER_EVENT per connection event and
+ * CONFIG_XBOX_CONTROLLER_BLE_TX_MAX_IN_FLIGHT not yet acknowledged by the
+ * controller. Without input traffic the budget is refilled by a fallback
+ * timer. A full queue is reported to the caller instead of dropping data.
+ */
+
+K_MSGQ_DEFINE(tx_queue, sizeof(struct xbox_controller_report_output),
+              CONFIG_XBOX_CONTROLLER_BLE_TX_QUEUE_DEPTH, 1);
+
+static void tx_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(tx_work, tx_work_handler);
+
+static struct bt_conn *tx_conn;
+static uint16_t tx_handle;
+static atomic_t in_flight;
+static atomic_t event_budget;
+static atomic_t sent_since_notify;
+static int64_t last_event_ms;
+static uint32_t interval_us;
+// an effect is playing, keep stepping the engine without queued writes
+// written under ff_lock together with the engine state it reflects, read without it
+static atomic_t ff_running;
+
+static void update_depth(void)
+{
+        uint32_t depth = k_msgq_num_used_get(&tx_queue);
+
+        xbox_ble_stats.tx_queue_depth = depth;
+        xbox_ble_stats.tx_queue_peak = MAX(xbox_ble_stats.tx_queue_peak, depth);
+}
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE)
+/*
+ * Rumble requests go to the effect engine instead of the queue. The engine
+ * is stepped whenever the work item runs, i.e. after every connection event
+ * with input and on the fallback timer, and only its updates are queued.
+ */
+static struct k_spinlock ff_lock;
+static struct ff_engine ff = {
+    .step = CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE_STEP,
+    .lead_ms = CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE_LEAD_MS,
+    .min_hold_ms = CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE_MIN_HOLD_MS,
+};
+
+static void ff_step(int64_t now)
+{
+        struct xbox_controller_report_output report;
+        k_spinlock_key_t key = k_spin_lock(&ff_lock);
+        bool update = ff_engine_tick(&ff, (uint32_t)now, &report);
+
+        // a request that arrives after the unlock sets it again, it cannot be lost
+        atomic_set(&ff_running, ff_engine_active(&ff, (uint32_t)now));
+        k_spin_unlock(&ff_lock, key);
+
+        if (update)
+        {
+                // every update carries the full motor state, anything still queued is stale
+                k_msgq_purge(&tx_queue);
+                k_msgq_put(&tx_queue, &report, K_NO_WAIT);
+                update_depth();
+        }
+}
+#endif
+
+static void tx_done(struct bt_conn *conn, void *user_data)
+{
+        // writes still pending when the link went down may complete after tx_sched_stop()
+        if (atomic_get(&in_flight) > 0)
+        {
+                atomic_dec(&in_flight);
+        }
+        k_work_reschedule(&tx_work, K_NO_WAIT);
+}
+
+static void tx_work_handler(struct k_work *work)
+{
+        struct xbox_controller_report_output report;
+        int64_t now = k_uptime_get();
+        int err;
+
+        if (!tx_conn)
+        {
+                return;
+        }
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE)
+        ff_step(now);
+#endif
+
+        if (now - last_event_ms >= CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS)
+        {
+                atomic_set(&event_budget, CONFIG_XBOX_CONTROLLER_BLE_TX_PER_EVENT);
+                last_event_ms = now;
+        }
+
+        while ((atomic_get(&event_budget) > 0) &&
+               (atomic_get(&in_flight) < CONFIG_XBOX_CONTROLLER_BLE_TX_MAX_IN_FLIGHT) &&
+               (k_msgq_peek(&tx_queue, &report) == 0))
+        {
+                err = bt_gatt_write_without_response_cb(tx_conn, tx_handle, &report, sizeof(report),
+                                                        false, tx_done, NULL);
+                if (err == -ENOMEM || err == -ENOBUFS)
+                {
+                        // TX buffers exhausted, keep the report and retry after the next event
+                        break;
+                }
+
+                k_msgq_get(&tx_queue, &report, K_NO_WAIT);
+                update_depth();
+
+                if (err)
+                {
+                        LOG_ERR("Rumble write failed (err %d)", err);
+                        continue;
+                }
+
+                atomic_inc(&in_flight);
+                atomic_dec(&event_budget);
+                atomic_inc(&sent_since_notify);
+                xbox_ble_stats.tx_writes++;
+        }
+
+        if (atomic_get(&ff_running) || k_msgq_num_used_get(&tx_queue) > 0)
+        {
+                k_work_schedule(&tx_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS));
+        }
+}
+
+void tx_sched_start(struct bt_conn *conn, uint16_t write_handle)
+{
+        tx_sched_stop();
+
+        tx_conn = bt_conn_ref(conn);
+        tx_handle = write_handle;
+}
+
+void tx_sched_stop(void)
+{
+        k_work_cancel_delayable(&tx_work);
+        k_msgq_purge(&tx_queue);
+        update_depth();
+        atomic_clear(&in_flight);
+        atomic_clear(&sent_since_notify);
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE)
+        k_spinlock_key_t key = k_spin_lock(&ff_lock);
+
+        ff_engine_reset(&ff);
+        atomic_clear(&ff_running);
+        k_spin_unlock(&ff_lock, key);
+#endif
+
+        if (tx_conn)
+        {
+                bt_conn_unref(tx_conn);
+                tx_conn = NULL;
+        }
+        tx_handle = 0;
+}
+
+void tx_sched_set_interval(uint32_t interval)
+{
+        interval_us = interval;
+}
+
+void tx_sched_on_notify(uint32_t gap_us)
+{
+        // input that arrived more than half an interval late while rumble was sent
+        if (atomic_clear(&sent_since_notify) && (interval_us != 0) && (gap_us != 0) &&
+            (gap_us > interval_us + interval_us / 2))
+        {
+                uint32_t delay = gap_us - interval_us;
+
+                xbox_ble_stats.tx_input_delay_events++;
+                xbox_ble_stats.tx_input_delay_total_us += delay;
+                xbox_ble_stats.tx_input_delay_max_us = MAX(xbox_ble_stats.tx_input_delay_max_us, delay);
+        }
+
+        last_event_ms = k_uptime_get();
+        atomic_set(&event_budget, CONFIG_XBOX_CONTROLLER_BLE_TX_PER_EVENT);
+
+        if (atomic_get(&ff_running) || k_msgq_num_used_get(&tx_queue) > 0)
+        {
+                k_work_reschedule(&tx_work, K_NO_WAIT);
+        }
+}
+
+bool rumble_queue_full(void)
+{
+        return k_msgq_num_free_get(&tx_queue) == 0;
+}
+
+int request_rumble(struct xbox_controller_report_output *report)
+{
+        if (!tx_conn)
+        {
+                return -EIO;
+        }
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE)
+        k_spinlock_key_t key = k_spin_lock(&ff_lock);
+
+        ff_engine_set_effect(&ff, report, (uint32_t)k_uptime_get());
+        // played from the next connection event on, never refused
+        atomic_set(&ff_running, true);
+        k_spin_unlock(&ff_lock, key);
+#else
+        if (k_msgq_put(&tx_queue, report, K_NO_WAIT))
+        {
+                xbox_ble_stats.tx_backpressure++;
+                return -EAGAIN;
+        }
+        update_depth();
+#endif
+
+        k_work_schedule(&tx_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS));
+
+        return 0;
+}
+
+#if defined(CONFIG_XBOX_CONTROLLER_BLE_FF_ENGINE)
+int xbox_controller_ff_play(uint8_t slot, const struct ff_effect *effect)
+{
+        k_spinlock_key_t key;
+        int err;
+
+        if (slot == FF_ENGINE_HOST_SLOT)
+        {
+                return -EINVAL;
+        }
+
+        if (!tx_conn)
+        {
+                return -EIO;
+        }
+
+        key = k_spin_lock(&ff_lock);
+        err = ff_engine_play(&ff, slot, effect, (uint32_t)k_uptime_get());
+        atomic_set(&ff_running, true);
+        k_spin_unlock(&ff_lock, key);
+
+        k_work_schedule(&tx_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS));
+
+        return err;
+}
+
+int xbox_controller_ff_stop(uint8_t slot)
+{
+        k_spinlock_key_t key;
+        int err;
+
+        if (slot == FF_ENGINE_HOST_SLOT)
+        {
+                return -EINVAL;
+        }
+
+        key = k_spin_lock(&ff_lock);
+        err = ff_engine_stop(&ff, slot);
+        k_spin_unlock(&ff_lock, key);
+
+        k_work_schedule(&tx_work, K_MSEC(CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS));
+
+        return err;
+}
+#endif
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+
+#include <zephyr/bluetooth/conn.h>
+
+#pragma once
+
+// start sending queued rumble writes to the given handle
+void tx_sched_start(struct bt_conn *conn, uint16_t write_handle);
+
+// stop sending and drop everything still queued, the link is gone
+void tx_sched_stop(void);
+
+// connection interval in microseconds, used to attribute input delay to TX traffic
+void tx_sched_set_interval(uint32_t interval_us);
+
+// an input notification arrived, i.e. a connection event took place
+// gap_us is the time since the previous notification, 0 for the first one
+void tx_sched_on_notify(uint32_t gap_us);
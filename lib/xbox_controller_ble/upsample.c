@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+
+#include "xbox_controller_ble/upsample.h"
+
+#define STICK_MAX 65535
+#define TRIGGER_MAX 1023
+
+/* segments longer than this are not extrapolated, keeps the math in 32 bit */
+#define MAX_INTERVAL_US 65535
+#define FRAC_SHIFT 15
+#define FILTER_SHIFT 4
+
+static const int32_t axis_max[UPSAMPLE_AXES] = {
+    STICK_MAX, STICK_MAX, STICK_MAX, STICK_MAX, TRIGGER_MAX, TRIGGER_MAX};
+
+static void get_axes(const struct xbox_controller_report *r, int32_t axes[UPSAMPLE_AXES])
+{
+        axes[0] = r->lstick_x;
+        axes[1] = r->lstick_y;
+        axes[2] = r->rstick_x;
+        axes[3] = r->rstick_y;
+        axes[4] = r->lt;
+        axes[5] = r->rt;
+}
+
+static void set_axes(struct xbox_controller_report *r, const int32_t axes[UPSAMPLE_AXES])
+{
+        r->lstick_x = axes[0];
+        r->lstick_y = axes[1];
+        r->rstick_x = axes[2];
+        r->rstick_y = axes[3];
+        r->lt = axes[4];
+        r->rt = axes[5];
+}
+
+void upsample_init(struct upsample *upsample, enum upsample_mode mode, uint16_t filter_alpha)
+{
+        memset(upsample, 0, sizeof(*upsample));
+        upsample->mode = mode;
+        upsample->filter_alpha = CLAMP(filter_alpha, 1, 256);
+}
+
+void upsample_push(struct upsample *upsample, const struct xbox_controller_report *report,
+                   uint32_t now_us)
+{
+        get_axes(&upsample->last, upsample->prev_axes);
+        upsample->interval_us = upsample->valid ? (now_us - upsample->last_us) : 0;
+        upsample->last = *report;
+        upsample->last_us = now_us;
+
+        if (!upsample->valid)
+        {
+                get_axes(report, upsample->prev_axes);
+                get_axes(report, upsample->filtered);
+                for (int i = 0; i < UPSAMPLE_AXES; i++)
+                {
+                        upsample->filtered[i] <<= FILTER_SHIFT;
+                }
+                upsample->valid = true;
+        }
+}
+
+/*
+ * Extrapolate at most one interval past the last sample. A sample that is
+ * overdue means the controller (or the deduplication in front of us) saw no
+ * change, so the estimate falls back to the last sample instead of drifting.
+ */
+static void estimate_linear(const struct upsample *upsample, uint32_t now_us,
+                            int32_t axes[UPSAMPLE_AXES])
+{
+        uint32_t interval = upsample->interval_us;
+        uint32_t elapsed = now_us - upsample->last_us;
+
+        get_axes(&upsample->last, axes);
+
+        if ((interval == 0) || (interval > MAX_INTERVAL_US) || (elapsed > interval))
+        {
+                return;
+        }
+
+        int32_t frac = (elapsed << FRAC_SHIFT) / interval;
+
+        for (int i = 0; i < UPSAMPLE_AXES; i++)
+        {
+                int32_t delta = axes[i] - upsample->prev_axes[i];
+
+                axes[i] = CLAMP(axes[i] + (delta * frac) / (1 << FRAC_SHIFT), 0, axis_max[i]);
+        }
+}
+
+void upsample_get(struct upsample *upsample, uint32_t now_us, struct xbox_controller_report *out)
+{
+        int32_t axes[UPSAMPLE_AXES];
+
+        *out = upsample->last;
+
+        if (!upsample->valid || (upsample->mode == UPSAMPLE_HOLD))
+        {
+                return;
+        }
+
+        estimate_linear(upsample, now_us, axes);
+
+        if (upsample->mode == UPSAMPLE_FILTER)
+        {
+                for (int i = 0; i < UPSAMPLE_AXES; i++)
+                {
+                        int32_t diff = (axes[i] << FILTER_SHIFT) - upsample->filtered[i];
+
+                        upsample->filtered[i] += (diff * upsample->filter_alpha) / 256;
+                        axes[i] = upsample->filtered[i] >> FILTER_SHIFT;
+                }
+        }
+
+        set_axes(out, axes);
+}
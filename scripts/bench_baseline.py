@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# Copyright (c) 2023 Maximilian Deubel
+# SPDX-License-Identifier: Apache-2.0
+
+"""Record benchmark baselines from native_posix twister logs.
+
+Every benchmark of tests/pipeline prints "BASELINE <name> <ps>". The slowest
+value of each benchmark over all given logs replaces the matching
+BASELINE_<NAME>_PS define in baseline.h. Pass the logs of several runs to
+leave headroom for the run to run variation:
+
+  west twister -T tests -p native_posix
+  scripts/bench_baseline.py twister-out/native_posix/tests/pipeline/*/handler.log
+"""
+
+import argparse
+import re
+import sys
+
+BASELINE_LINE = re.compile(r'BASELINE (\w+) (\d+)')
+
+
+def measurements(paths):
+    slowest = {}
+    for path in paths:
+        with open(path) as f:
+            for match in BASELINE_LINE.finditer(f.read()):
+                name, ps = match.group(1), int(match.group(2))
+                slowest[name] = max(slowest.get(name, 0), ps)
+    return slowest
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('logs', nargs='+', help='twister handler.log files')
+    parser.add_argument('--header', default='tests/pipeline/src/baseline.h',
+                        help='baseline header to update')
+    args = parser.parse_args()
+
+    slowest = measurements(args.logs)
+    if not slowest:
+        print('bench_baseline: no BASELINE lines found')
+        return 1
+
+    with open(args.header) as f:
+        header = f.read()
+
+    for name, ps in sorted(slowest.items()):
+        define = f'BASELINE_{name.upper()}_PS'
+        header, count = re.subn(rf'(#define {define}) \d+', rf'\g<1> {ps}', header)
+        if count == 0:
+            print(f'bench_baseline: {define} is not in {args.header}')
+            return 1
+        print(f'bench_baseline: {define} {ps}')
+
+    with open(args.header, 'w') as f:
+        f.write(header)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+# Copyright (c) 2023 Maximilian Deubel
+# SPDX-License-Identifier: Apache-2.0
+
+"""Print the RAM/ROM usage of a Zephyr ELF and check it against a budget.
+
+The totals are computed the same way the linker memory report does it:
+every allocated section that carries data counts towards ROM (including
+the load image of initialised data), every writable section towards RAM.
+The largest symbols are listed as well so a budget violation can be
+traced back to a buffer pool, stack or table without a full ram_report.
+
+With --record the measured totals are written to the budget file as the
+new budget of the board instead of being checked.
+"""
+
+import argparse
+import sys
+
+import yaml
+from elftools.elf.constants import SH_FLAGS
+from elftools.elf.elffile import ELFFile
+from elftools.elf.sections import SymbolTableSection
+
+
+def section_usage(elf):
+    rom = 0
+    ram = 0
+    rom_sections = set()
+    ram_sections = set()
+
+    for index, section in enumerate(elf.iter_sections()):
+        flags = section['sh_flags']
+        size = section['sh_size']
+        if not flags & SH_FLAGS.SHF_ALLOC or size == 0:
+            continue
+        if section['sh_type'] != 'SHT_NOBITS':
+            rom += size
+            rom_sections.add(index)
+        if flags & SH_FLAGS.SHF_WRITE:
+            ram += size
+            ram_sections.add(index)
+
+    return rom, ram, rom_sections, ram_sections
+
+
+def largest_symbols(elf, sections, count):
+    symbols = []
+    for table in elf.iter_sections():
+        if not isinstance(table, SymbolTableSection):
+            continue
+        for sym in table.iter_symbols():
+            if sym['st_info']['type'] not in ('STT_OBJECT', 'STT_FUNC'):
+                continue
+            if sym['st_shndx'] in sections and sym['st_size'] > 0:
+                symbols.append((sym['st_size'], sym.name))
+    return sorted(symbols, reverse=True)[:count]
+
+
+def record_budget(path, budgets):
+    # keep the comment header, the entries below it are rewritten
+    with open(path) as f:
+        header = [line for line in f if line.startswith('#')]
+    with open(path, 'w') as f:
+        f.writelines(header)
+        f.write('\n')
+        yaml.safe_dump(budgets, f, default_flow_style=False)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('elf', help='zephyr.elf of the build')
+    parser.add_argument('--budget', required=True, help='budget YAML file')
+    parser.add_argument('--board', required=True, help='board name used as budget key')
+    parser.add_argument('--top', type=int, default=10, help='number of symbols to list')
+    parser.add_argument('--record', action='store_true',
+                        help='store the measured totals as the budget of the board')
+    args = parser.parse_args()
+
+    with open(args.budget) as f:
+        budgets = yaml.safe_load(f) or {}
+
+    with open(args.elf, 'rb') as f:
+        elf = ELFFile(f)
+        rom, ram, rom_sections, ram_sections = section_usage(elf)
+
+        for name, sections in (('RAM', ram_sections), ('ROM', rom_sections)):
+            print(f'footprint: largest {name} symbols')
+            for size, sym in largest_symbols(elf, sections, args.top):
+                print(f'  {size:8d}  {sym}')
+
+    if args.record:
+        budgets[args.board] = {'ram': ram, 'rom': rom}
+        record_budget(args.budget, budgets)
+        print(f'footprint: recorded RAM {ram} / ROM {rom} bytes for {args.board}')
+        return 0
+
+    if args.board not in budgets:
+        print(f'footprint: RAM {ram}, ROM {rom} bytes, no budget for {args.board}, '
+              'record one with --record')
+        return 1
+    budget = budgets[args.board]
+
+    failed = False
+    for name, used, limit in (('RAM', ram, budget['ram']), ('ROM', rom, budget['rom'])):
+        state = 'ok' if used <= limit else 'OVER BUDGET'
+        print(f'footprint: {name} {used} / {limit} bytes ({state})')
+        failed |= used > limit
+
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/*
+ * Baselines in picoseconds per operation on native_posix, used together with
+ * CONFIG_PIPELINE_BENCH_TOLERANCE_PCT. Each benchmark prints its measurement
+ * as "BASELINE <name> <ps>"; scripts/bench_baseline.py writes the slowest of
+ * the given twister logs back into this file. Rerun it in the same commit
+ * that changes the hot path on purpose.
+ *
+ * 0 means no native_posix run has been recorded yet, and the benchmark fails
+ * until one is.
+ */
+#define BASELINE_CONVERT_IN_REPORT_PS 0
+#define BASELINE_CONVERT_XINPUT_REPORT_PS 0
+#define BASELINE_REPORT_FILTER_CHECK_PS 0
+#define BASELINE_ZBUS_PUB_READ_PS 0
+#define BASELINE_NOTIFY_PS 0
+#define BASELINE_SCAN_FILTER_PS 0
+#define BASELINE_SCAN_RECV_PS 0
+#define BASELINE_UPSAMPLE_GET_PS 0
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/ztest.h>
+#include <zephyr/zbus/zbus.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "xbox_controller_ble/upsample.h"
+#include "ingest.h"
+#include "report_filter.h"
+#include "scan_filter.h"
+#include "baseline.h"
+#include "host_clock.h"
+
+#define ITERATIONS CONFIG_PIPELINE_BENCH_ITERATIONS
+
+ZBUS_CHAN_DECLARE(controller_report);
+
+static volatile uint32_t sink;
+
+static uint8_t adv_data[] = {
+    0x02, 0x01, 0x06,
+    0x03, 0x19, 0xC4, 0x03,
+    0x19, 0x09, 'X', 'b', 'o', 'x', ' ', 'W', 'i', 'r', 'e', 'l', 'e', 's', 's',
+    ' ', 'C', 'o', 'n', 't', 'r', 'o', 'l', 'l', 'e', 'r',
+};
+
+/*
+ * native_posix has no cycle counter and its clocks, the RTC model included,
+ * follow simulated time, which stands still while code runs. The benchmarks
+ * read the host's monotonic clock instead.
+ */
+static uint64_t bench_now_ns(void)
+{
+        return host_clock_ns();
+}
+
+// synthetic stick sweep, every call yields a report that differs from the last one
+static void make_report(struct xbox_controller_report *r, uint32_t i)
+{
+        memset(r, 0, sizeof(*r));
+        r->lstick_x = (uint16_t)(i * 257);
+        r->lstick_y = (uint16_t)(65535 - i * 257);
+        r->rstick_x = 32767;
+        r->rstick_y = 32767;
+        r->lt = i & 1023;
+        r->a = i >> 4;
+}
+
+static void bench_report(const char *name, uint64_t start, uint64_t end, uint32_t baseline_ps)
+{
+        uint64_t ns = end - start;
+        uint64_t ps_per_op = ns * 1000 / ITERATIONS;
+        uint64_t ops_per_sec = ns ? (uint64_t)ITERATIONS * NSEC_PER_SEC / ns : 0;
+        uint64_t limit_ps = (uint64_t)baseline_ps * (100 + CONFIG_PIPELINE_BENCH_TOLERANCE_PCT) / 100;
+
+        TC_PRINT("%s: %llu.%03llu ns/op, %llu reports/s\n", name,
+                 ps_per_op / 1000, ps_per_op % 1000, ops_per_sec);
+        TC_PRINT("BASELINE %s %llu\n", name, ps_per_op);
+
+        zassert_true(ns > 0, "%s: clock did not advance", name);
+        zassert_true(baseline_ps != 0, "%s: no baseline recorded, see baseline.h", name);
+        zassert_true(ps_per_op <= limit_ps, "%s regressed: %llu ps/op, limit %llu ps/op",
+                     name, ps_per_op, limit_ps);
+}
+
+ZTEST(pipeline_bench, test_bench_convert_in_report)
+{
+        struct xbox_controller_report in;
+        inputReport01_t out;
+        uint64_t start, end;
+
+        make_report(&in, 1);
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                in.lstick_x = i;
+                convert_in_report(&in, &out);
+                sink = out.GD_GamePadX;
+        }
+        end = bench_now_ns();
+
+        bench_report("convert_in_report", start, end, BASELINE_CONVERT_IN_REPORT_PS);
+}
+
+ZTEST(pipeline_bench, test_bench_convert_xinput_report)
+{
+        struct xbox_controller_report in;
+        xinputReport_t out;
+        uint64_t start, end;
+
+        make_report(&in, 1);
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                in.lstick_x = i;
+                in.dpad.raw = i & 7;
+                convert_xinput_report(&in, &out);
+                sink = out.thumbLX;
+        }
+        end = bench_now_ns();
+
+        bench_report("convert_xinput_report", start, end, BASELINE_CONVERT_XINPUT_REPORT_PS);
+}
+
+ZTEST(pipeline_bench, test_bench_report_filter)
+{
+        static struct xbox_controller_report trace[64];
+        struct report_filter filter;
+        uint64_t start, end;
+
+        for (uint32_t i = 0; i < ARRAY_SIZE(trace); i++)
+        {
+                make_report(&trace[i], i / 2);
+        }
+        report_filter_init(&filter, 128, 2, 100);
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                sink = report_filter_check(&filter, (uint8_t *)&trace[i % ARRAY_SIZE(trace)], i);
+        }
+        end = bench_now_ns();
+
+        bench_report("report_filter_check", start, end, BASELINE_REPORT_FILTER_CHECK_PS);
+}
+
+ZTEST(pipeline_bench, test_bench_zbus_pub_read)
+{
+        struct xbox_controller_report in, out;
+        uint64_t start, end;
+
+        make_report(&in, 1);
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                in.lstick_x = i;
+                zbus_chan_pub(&controller_report, &in, K_NO_WAIT);
+                zbus_chan_read(&controller_report, &out, K_NO_WAIT);
+                sink = out.lstick_x;
+        }
+        end = bench_now_ns();
+
+        bench_report("zbus_pub_read", start, end, BASELINE_ZBUS_PUB_READ_PS);
+}
+
+/* notify_func() without the GATT layer: length check, dedup and publish */
+ZTEST(pipeline_bench, test_bench_notify)
+{
+        static uint8_t payloads[16][sizeof(struct xbox_controller_report)];
+        struct xbox_controller_report r;
+        uint64_t start, end;
+
+        for (uint32_t i = 0; i < ARRAY_SIZE(payloads); i++)
+        {
+                make_report(&r, i);
+                memcpy(payloads[i], &r, sizeof(r));
+        }
+        report_ingest_init(true, 128, 2, 100);
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                sink = report_ingest(payloads[i % ARRAY_SIZE(payloads)], sizeof(payloads[0]), i);
+        }
+        end = bench_now_ns();
+
+        bench_report("notify", start, end, BASELINE_NOTIFY_PS);
+}
+
+ZTEST(pipeline_bench, test_bench_scan_filter)
+{
+        uint64_t start, end;
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                sink = scan_filter_match(-40 - (i & 7), adv_data, sizeof(adv_data));
+        }
+        end = bench_now_ns();
+
+        bench_report("scan_filter", start, end, BASELINE_SCAN_FILTER_PS);
+}
+
+/*
+ * scan_recv() without the connection setup: bond lookup and advertising
+ * filter for unbonded devices while pairing, the common case in a busy room
+ */
+ZTEST(pipeline_bench, test_bench_scan_recv)
+{
+        bt_addr_le_t addr = {.type = BT_ADDR_LE_RANDOM};
+        struct net_buf_simple buf = {.data = adv_data, .len = sizeof(adv_data)};
+        struct bt_le_scan_recv_info info = {.addr = &addr};
+        uint64_t start, end;
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                addr.a.val[0] = i;
+                info.rssi = -40 - (i & 63);
+                sink = scan_filter_recv(&info, &buf, true);
+        }
+        end = bench_now_ns();
+
+        bench_report("scan_recv", start, end, BASELINE_SCAN_RECV_PS);
+}
+
+/* worst case per USB report: smoothed extrapolation on every call */
+ZTEST(pipeline_bench, test_bench_upsample)
+{
+        struct xbox_controller_report in, out;
+        struct upsample upsample;
+        uint64_t start, end;
+
+        upsample_init(&upsample, UPSAMPLE_FILTER, 64);
+        make_report(&in, 1);
+        upsample_push(&upsample, &in, 0);
+        make_report(&in, 2);
+        upsample_push(&upsample, &in, 7500);
+
+        start = bench_now_ns();
+        for (uint32_t i = 0; i < ITERATIONS; i++)
+        {
+                upsample_get(&upsample, 7500 + (i % 7500), &out);
+                sink = out.lstick_x;
+        }
+        end = bench_now_ns();
+
+        bench_report("upsample_get", start, end, BASELINE_UPSAMPLE_GET_PS);
+}
+
+ZTEST_SUITE(pipeline_bench, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/sys/util.h>
+
+#include "chan_classifier.h"
+
+/* emulated link: channel hopping over the mapped channels, noise on a few of them */
+struct noisy_link
+{
+        uint32_t rng;
+        uint8_t channel;
+        uint8_t error_percent[CHAN_CLASSIFIER_CHANNELS];
+};
+
+static uint32_t link_rand(struct noisy_link *link)
+{
+        link->rng = link->rng * 1103515245 + 12345;
+        return link->rng >> 16;
+}
+
+static void run_events(struct noisy_link *link, struct chan_classifier *cls, int events)
+{
+        for (int i = 0; i < events; i++)
+        {
+                // hop to the next channel in the current map, like channel selection #1 with hop 7
+                do
+                {
+                        link->channel = (link->channel + 7) % CHAN_CLASSIFIER_CHANNELS;
+                } while (!(cls->map[link->channel / 8] & BIT(link->channel % 8)));
+
+                bool error = (link_rand(link) % 100) < link->error_percent[link->channel];
+
+                chan_classifier_record(cls, link->channel, error);
+        }
+}
+
+static int map_count(const struct chan_classifier *cls)
+{
+        int count = 0;
+
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                count += !!(cls->map[ch / 8] & BIT(ch % 8));
+        }
+        return count;
+}
+
+ZTEST(chan_classifier, test_noisy_channels_excluded)
+{
+        struct chan_classifier cls;
+        struct noisy_link link = {.rng = 1};
+
+        // a Wi-Fi channel on top of data channels 0..8, light background noise elsewhere
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                link.error_percent[ch] = (ch <= 8) ? 60 : 2;
+        }
+
+        chan_classifier_init(&cls, 25, 20, 20);
+        run_events(&link, &cls, 4000);
+
+        zassert_true(chan_classifier_update(&cls), "map not updated");
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                bool used = cls.map[ch / 8] & BIT(ch % 8);
+
+                zassert_equal(used, ch > 8, "channel %d misclassified", ch);
+        }
+
+        run_events(&link, &cls, 4000);
+        zassert_false(chan_classifier_update(&cls), "map changed on a stable link");
+}
+
+ZTEST(chan_classifier, test_minimum_channels_kept)
+{
+        struct chan_classifier cls;
+        struct noisy_link link = {.rng = 7};
+
+        for (int ch = 0; ch < CHAN_CLASSIFIER_CHANNELS; ch++)
+        {
+                link.error_percent[ch] = (ch < 30) ? 80 : 40 + ch;
+        }
+
+        chan_classifier_init(&cls, 25, 20, 10);
+        run_events(&link, &cls, 8000);
+        chan_classifier_update(&cls);
+
+        zassert_equal(map_count(&cls), 10, "minimum channel count not kept");
+        zassert_true(cls.map[30 / 8] & BIT(30 % 8), "least bad channel dropped");
+
+        chan_classifier_recover(&cls);
+        zassert_equal(map_count(&cls), CHAN_CLASSIFIER_CHANNELS, "channels not recovered");
+}
+
+ZTEST_SUITE(chan_classifier, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include "xbox_controller_ble/ff_engine.h"
+
+/* connection interval of the simulated link and length of the rumble trace */
+#define BLE_INTERVAL_US 7500
+#define TRACE_MS 8000
+#define STEP 4
+#define LEAD_MS 20
+#define MIN_HOLD_MS 100
+
+#define STRONG 2
+#define WEAK 3
+#define ENABLE_STRONG 0x02
+#define ENABLE_WEAK 0x01
+
+/* what the controller plays after a rumble write, see ff_engine_set_effect() */
+struct motor_model
+{
+        struct xbox_controller_report_output report;
+        uint32_t at_ms;
+        bool valid;
+};
+
+struct rumble_result
+{
+        uint32_t writes;
+        uint32_t mean_error; // in 1/100 percent per motor and ms while the motor should or does run
+        uint32_t max_start_ms; // longest time from a motor start on the host to the controller
+};
+
+static void model_apply(struct motor_model *model, const struct xbox_controller_report_output *r,
+                        uint32_t now_ms)
+{
+        model->report = *r;
+        model->at_ms = now_ms;
+        model->valid = true;
+}
+
+static uint8_t model_level(const struct motor_model *model, size_t motor, uint32_t now_ms)
+{
+        const struct xbox_controller_report_output *r = &model->report;
+        uint32_t t = now_ms - model->at_ms;
+        uint32_t start = r->StartDelay * 10;
+        uint32_t length = r->Duration * 10 * (r->LoopCount + 1);
+
+        if (!model->valid || !(r->DcEnableActuators & BIT(FF_MOTORS - 1 - motor)) ||
+            t < start || t >= start + length)
+        {
+                return 0;
+        }
+
+        return r->Magnitude[motor];
+}
+
+static void set_effect(struct xbox_controller_report_output *r, uint8_t strong, uint8_t weak,
+                       uint8_t duration, uint8_t loops)
+{
+        memset(r, 0, sizeof(*r));
+        r->DcEnableActuators = (strong ? ENABLE_STRONG : 0) | (weak ? ENABLE_WEAK : 0);
+        r->Magnitude[STRONG] = strong;
+        r->Magnitude[WEAK] = weak;
+        r->Duration = duration;
+        r->LoopCount = loops;
+}
+
+/*
+ * Typical game rumble as a host drives it through SetEffect reports:
+ * an explosion faded out in 10 ms steps, an engine idle wobbling between
+ * two levels, short hits each followed by a stop, and a level that is
+ * re-sent every frame the way XInput games do.
+ */
+static bool host_write(uint32_t t, struct xbox_controller_report_output *r)
+{
+        if (t < 600)
+        {
+                if (t % 10)
+                {
+                        return false;
+                }
+                set_effect(r, 100 - t / 6, (600 - t) / 10, 2, 0);
+                return true;
+        }
+        if (t == 600)
+        {
+                set_effect(r, 0, 0, 0, 0);
+                return true;
+        }
+        if (t >= 1000 && t < 3000)
+        {
+                uint32_t phase = (t - 1000) % 200;
+
+                if (t % 10)
+                {
+                        return false;
+                }
+                set_effect(r, 0, 20 + (phase < 100 ? phase : 200 - phase) / 5, 2, 0);
+                return true;
+        }
+        if (t >= 3500 && t < 5500)
+        {
+                uint32_t phase = (t - 3500) % 400;
+
+                if (phase == 0)
+                {
+                        set_effect(r, 80, 0, 12, 0);
+                        return true;
+                }
+                if (phase == 120)
+                {
+                        set_effect(r, 0, 0, 0, 0);
+                        return true;
+                }
+                return false;
+        }
+        if (t >= 6000 && t < 7500)
+        {
+                if ((t - 6000) % 16)
+                {
+                        return false;
+                }
+                set_effect(r, 60, 30, 0xFF, 0xEB);
+                return true;
+        }
+        if (t == 7500)
+        {
+                set_effect(r, 0, 0, 0, 0);
+                return true;
+        }
+        return false;
+}
+
+/*
+ * Replays the host trace over a simulated link with one rumble write per
+ * connection event. The reference applies every host write the moment it is
+ * made; the error is the difference in motor level against it.
+ */
+static void replay(bool use_engine, struct rumble_result *result)
+{
+        struct motor_model ideal = {0}, controller = {0};
+        struct xbox_controller_report_output r, queue[64];
+        uint32_t head = 0, tail = 0;
+        uint32_t start_at[FF_MOTORS];
+        bool starting[FF_MOTORS] = {false};
+        bool wanted_before[FF_MOTORS] = {false};
+        uint64_t error_sum = 0;
+        uint32_t samples = 0;
+        struct ff_engine engine;
+
+        ff_engine_init(&engine, STEP, LEAD_MS, MIN_HOLD_MS);
+        memset(result, 0, sizeof(*result));
+
+        for (uint32_t t_us = 0; t_us < TRACE_MS * 1000; t_us += 250)
+        {
+                uint32_t t = t_us / 1000;
+
+                if ((t_us % 1000) == 0 && host_write(t, &r))
+                {
+                        model_apply(&ideal, &r, t);
+                        if (use_engine)
+                        {
+                                ff_engine_set_effect(&engine, &r, t);
+                        }
+                        else
+                        {
+                                zassert_true(tail - head < ARRAY_SIZE(queue), "queue overflow");
+                                queue[tail % ARRAY_SIZE(queue)] = r;
+                                tail++;
+                        }
+                }
+
+                if ((t_us % BLE_INTERVAL_US) == 0)
+                {
+                        if (use_engine && ff_engine_tick(&engine, t, &r))
+                        {
+                                model_apply(&controller, &r, t);
+                                result->writes++;
+                        }
+                        else if (!use_engine && head != tail)
+                        {
+                                model_apply(&controller, &queue[head % ARRAY_SIZE(queue)], t);
+                                head++;
+                                result->writes++;
+                        }
+                }
+
+                if ((t_us % 1000) == 0)
+                {
+                        for (size_t m = 0; m < FF_MOTORS; m++)
+                        {
+                                int played = model_level(&controller, m, t);
+                                int wanted = model_level(&ideal, m, t);
+
+                                if (played || wanted)
+                                {
+                                        error_sum += abs(played - wanted);
+                                        samples++;
+                                }
+
+                                if (wanted && !wanted_before[m])
+                                {
+                                        starting[m] = true;
+                                        start_at[m] = t;
+                                }
+                                if (starting[m] && played)
+                                {
+                                        starting[m] = false;
+                                        result->max_start_ms = MAX(result->max_start_ms, t - start_at[m]);
+                                }
+                                wanted_before[m] = wanted;
+                        }
+                }
+        }
+
+        result->mean_error = samples ? error_sum * 100 / samples : 0;
+}
+
+ZTEST(ff_engine, test_rumble_replay)
+{
+        struct rumble_result pass, engine;
+
+        replay(false, &pass);
+        replay(true, &engine);
+
+        TC_PRINT("rumble pass-through: %u writes/s, mean error %u.%02u %%, max start delay %u ms\n",
+                 pass.writes * 1000 / TRACE_MS, pass.mean_error / 100, pass.mean_error % 100,
+                 pass.max_start_ms);
+        TC_PRINT("rumble engine: %u writes/s, mean error %u.%02u %%, max start delay %u ms\n",
+                 engine.writes * 1000 / TRACE_MS, engine.mean_error / 100, engine.mean_error % 100,
+                 engine.max_start_ms);
+
+        zassert_true(engine.writes * 2 < pass.writes, "engine does not save writes");
+        zassert_true(engine.mean_error <= pass.mean_error + STEP * 100 / 2,
+                     "engine much less accurate than pass-through");
+        zassert_true(engine.max_start_ms * 1000 <= BLE_INTERVAL_US, "start later than one interval");
+}
+
+ZTEST(ff_engine, test_envelope_and_stop)
+{
+        struct ff_engine engine;
+        struct xbox_controller_report_output out;
+        struct ff_effect effect = {
+            .magnitude = {0, 0, 100, 0},
+            .waveform = FF_CONSTANT,
+            .duration_ms = 1000,
+            .envelope = {.attack_ms = 100, .attack_level = 0, .fade_ms = 200, .fade_level = 0},
+        };
+
+        ff_engine_init(&engine, STEP, LEAD_MS, MIN_HOLD_MS);
+        zassert_equal(ff_engine_play(&engine, FF_ENGINE_SLOTS, &effect, 0), -EINVAL, "bad slot");
+        zassert_equal(ff_engine_play(&engine, 1, &effect, 0), 0, "play failed");
+
+        // attack starts at zero, nothing to send yet
+        zassert_false(ff_engine_tick(&engine, 0, &out), "write for a silent motor");
+        zassert_true(ff_engine_tick(&engine, 10, &out), "attack not started");
+        zassert_equal(out.Magnitude[STRONG], 10, "attack level");
+        zassert_equal(out.DcEnableActuators, ENABLE_STRONG, "wrong actuator");
+        // the update holds until the effect ends
+        zassert_equal(out.Duration, 99, "hold not set to the effect end");
+
+        // changes below the step are not sent
+        zassert_false(ff_engine_tick(&engine, 12, &out), "sub-step change sent");
+        zassert_true(ff_engine_tick(&engine, 20, &out), "step not sent");
+        zassert_equal(out.Magnitude[STRONG], 20, "attack level");
+
+        // sustain: a single write covers it
+        zassert_true(ff_engine_tick(&engine, 100, &out), "sustain not reached");
+        for (uint32_t t = 100; t < 800; t += 7)
+        {
+                zassert_false(ff_engine_tick(&engine, t, &out), "write during sustain at %u", t);
+        }
+
+        // the fade ends at zero when the controller stops on its own, no stop write
+        uint32_t writes = 0;
+
+        for (uint32_t t = 800; t < 1100; t++)
+        {
+                if (ff_engine_tick(&engine, t, &out))
+                {
+                        zassert_true(out.Magnitude[STRONG] > 0, "stop write at %u", t);
+                        writes++;
+                }
+        }
+        zassert_true(writes <= 100 / STEP + 1, "too many fade writes: %u", writes);
+        zassert_false(ff_engine_active(&engine, 1100), "engine still active");
+
+        // an endless effect stopped early needs an explicit stop
+        effect.duration_ms = 0;
+        effect.envelope = (struct ff_envelope){0};
+        ff_engine_play(&engine, 1, &effect, 2000);
+        zassert_true(ff_engine_tick(&engine, 2000, &out), "endless effect not started");
+        zassert_equal(out.Duration, 255, "endless effect not held");
+        zassert_equal(out.LoopCount, 255, "endless effect not held");
+        ff_engine_stop(&engine, 1);
+        zassert_true(ff_engine_tick(&engine, 2010, &out), "stop not sent");
+        zassert_equal(out.DcEnableActuators, 0, "motors still enabled");
+        zassert_equal(out.Magnitude[STRONG], 0, "motor still on");
+
+        // every loop plays the attack and the fade again
+        effect.duration_ms = 1000;
+        effect.loop_count = 1;
+        effect.envelope = (struct ff_envelope){.attack_ms = 100, .fade_ms = 200};
+        ff_engine_play(&engine, 1, &effect, 3000);
+        zassert_true(ff_engine_tick(&engine, 3010, &out), "first loop not started");
+        zassert_equal(out.Magnitude[STRONG], 10, "attack level in the first loop");
+
+        uint8_t low = 100, level = 0;
+
+        for (uint32_t t = 3100; t < 4150; t++)
+        {
+                if (ff_engine_tick(&engine, t, &out))
+                {
+                        level = out.Magnitude[STRONG];
+                        low = (t >= 3800) ? MIN(low, level) : low;
+                }
+        }
+        zassert_true(low <= STEP, "fade and attack not repeated, lowest level %u", low);
+        zassert_true(level >= 100 - STEP, "second loop not sustained");
+}
+
+ZTEST(ff_engine, test_periodic_and_mix)
+{
+        struct ff_engine engine;
+        struct xbox_controller_report_output out, host;
+        struct ff_effect square = {
+            .magnitude = {0, 0, 0, 50},
+            .waveform = FF_SQUARE,
+            .period_ms = 100,
+            .duration_ms = 400,
+        };
+        uint32_t writes = 0;
+
+        ff_engine_init(&engine, STEP, LEAD_MS, MIN_HOLD_MS);
+        ff_engine_play(&engine, 1, &square, 0);
+
+        // one write per edge
+        for (uint32_t t = 0; t < 500; t++)
+        {
+                writes += ff_engine_tick(&engine, t, &out);
+        }
+        zassert_equal(writes, 8, "square wave writes: %u", writes);
+
+        // host and local effects add up, clamped to full level
+        set_effect(&host, 80, 70, 50, 0);
+        ff_engine_set_effect(&engine, &host, 1000);
+        ff_engine_play(&engine, 1, &square, 1000);
+        zassert_true(ff_engine_tick(&engine, 1000, &out), "mix not sent");
+        zassert_equal(out.Magnitude[STRONG], 80, "strong motor");
+        zassert_equal(out.Magnitude[WEAK], 100, "weak motor not clamped");
+        zassert_equal(out.DcEnableActuators, ENABLE_STRONG | ENABLE_WEAK, "actuators");
+
+        // a stop report from the host only ends the host effect
+        set_effect(&host, 0, 0, 0, 0);
+        ff_engine_set_effect(&engine, &host, 1010);
+        zassert_true(ff_engine_tick(&engine, 1010, &out), "host stop not sent");
+        zassert_equal(out.Magnitude[STRONG], 0, "host effect still on");
+        zassert_equal(out.Magnitude[WEAK], 50, "local effect stopped");
+}
+
+ZTEST_SUITE(ff_engine, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "host_clock.h"
+
+/*
+ * native_posix links against the host C library, but the Zephyr libc headers
+ * do not declare its clock functions. Declare clock_gettime() with the host
+ * ABI here, in a file that includes no libc header it could clash with.
+ * struct timespec is two longs on both the 32 and the 64 bit Linux ABI.
+ */
+#define HOST_CLOCK_MONOTONIC 1
+
+struct host_timespec
+{
+        long tv_sec;
+        long tv_nsec;
+};
+
+extern int clock_gettime(int clock_id, struct host_timespec *tp);
+
+uint64_t host_clock_ns(void)
+{
+        struct host_timespec ts;
+
+        clock_gettime(HOST_CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,11 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+
+#pragma once
+
+// monotonic host time in ns, advances while code runs unlike the simulated clock
+uint64_t host_clock_ns(void);
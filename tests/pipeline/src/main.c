@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+#include <zephyr/zbus/zbus.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "xbox_controller_ble/xinput_descr.h"
+#include "ingest.h"
+#include "report_filter.h"
+#include "scan_filter.h"
+
+ZBUS_CHAN_DECLARE(controller_report);
+
+static const struct xbox_controller_report neutral = {
+    .lstick_x = 32767, .lstick_y = 32767, .rstick_x = 32767, .rstick_y = 32767};
+
+static const uint8_t adv_controller[] = {
+    0x02, 0x01, 0x06,
+    0x19, 0x09, 'X', 'b', 'o', 'x', ' ', 'W', 'i', 'r', 'e', 'l', 'e', 's', 's',
+    ' ', 'C', 'o', 'n', 't', 'r', 'o', 'l', 'l', 'e', 'r',
+};
+
+/* the bond store is replaced by a single bonded address */
+static const bt_addr_le_t bonded_addr = {
+    .type = BT_ADDR_LE_RANDOM, .a = {.val = {0x01, 0x02, 0x03, 0x04, 0x05, 0xC6}}};
+
+bool bt_addr_le_is_bonded(uint8_t id, const bt_addr_le_t *addr)
+{
+        return (id == BT_ID_DEFAULT) && (bt_addr_le_cmp(addr, &bonded_addr) == 0);
+}
+
+ZTEST(pipeline, test_convert_in_report)
+{
+        struct xbox_controller_report in = neutral;
+        inputReport01_t out;
+
+        in.a = 1;
+        in.rstick_btn = 1;
+        in.lt = 1023;
+        in.dpad.raw = DOWN_LEFT;
+        convert_in_report(&in, &out);
+
+        zassert_equal(out.reportId, 1, "wrong report id");
+        zassert_equal(out.BTN_GamePadButton1, 1, "a not mapped");
+        zassert_equal(out.BTN_GamePadButton2, 0, "b set");
+        zassert_equal(out.BTN_GamePadButton11, 1, "rstick button not mapped");
+        zassert_equal(out.GD_GamePadX, 0x7F, "stick not centred");
+        zassert_equal(out.GD_GamePadRy, 0xFF, "trigger not scaled");
+        zassert_equal(out.GD_GamePadRz, 0, "trigger not scaled");
+        zassert_equal(out.GD_GamePadHatSwitch, DOWN_LEFT, "dpad not mapped");
+}
+
+ZTEST(pipeline, test_convert_xinput_report)
+{
+        struct xbox_controller_report in = neutral;
+        xinputReport_t out;
+
+        zassert_equal(sizeof(out), 20, "XInput report must be 20 bytes");
+
+        in.a = 1;
+        in.y = 1;
+        in.system = 1;
+        in.select = 1;
+        in.lt = 1023;
+        in.lstick_x = 65535;
+        in.lstick_y = 0;
+        in.rstick_x = 0;
+        in.rstick_y = 65535;
+        in.dpad.raw = DOWN_LEFT;
+        convert_xinput_report(&in, &out);
+
+        zassert_equal(out.msgType, 0x00, "wrong message type");
+        zassert_equal(out.msgLength, 20, "wrong message length");
+        zassert_equal(out.buttons,
+                      XINPUT_BTN_A | XINPUT_BTN_Y | XINPUT_BTN_GUIDE | XINPUT_BTN_BACK |
+                          XINPUT_BTN_DPAD_DOWN | XINPUT_BTN_DPAD_LEFT,
+                      "buttons not mapped: %04x", out.buttons);
+        zassert_equal(out.leftTrigger, 0xFF, "trigger not scaled");
+        zassert_equal(out.rightTrigger, 0, "trigger not scaled");
+        zassert_equal(out.thumbLX, 32767, "x not signed");
+        zassert_equal(out.thumbLY, 32767, "up must be positive");
+        zassert_equal(out.thumbRX, -32768, "x not signed");
+        zassert_equal(out.thumbRY, -32768, "down must be negative");
+
+        in = neutral;
+        in.dpad.raw = 0xF;
+        convert_xinput_report(&in, &out);
+        zassert_equal(out.buttons, 0, "invalid hat value must not press the dpad");
+        zassert_equal(out.thumbLX, -1, "stick not centred");
+}
+
+ZTEST(pipeline, test_convert_xinput_rumble)
+{
+        const uint8_t rumble[] = {0x00, 0x08, 0x00, 0xFF, 0x80, 0x00, 0x00, 0x00};
+        const uint8_t led[] = {0x01, 0x03, 0x06};
+        struct xbox_controller_report_output out = {0};
+
+        zassert_equal(convert_xinput_rumble(rumble, sizeof(rumble), &out), 0, "rumble rejected");
+        zassert_equal(out.DcEnableActuators, 0x3, "strong and weak motor must be enabled");
+        zassert_equal(out.Magnitude[0], 0, "trigger motor set");
+        zassert_equal(out.Magnitude[1], 0, "trigger motor set");
+        zassert_equal(out.Magnitude[2], 100, "strong motor not scaled");
+        zassert_equal(out.Magnitude[3], 50, "weak motor not scaled");
+        zassert_equal(out.Duration, 0xFF, "level not held for the longest duration");
+        zassert_equal(out.LoopCount, 0xFF, "level not held for the longest loop count");
+
+        zassert_equal(convert_xinput_rumble(led, sizeof(led), &out), -ENOTSUP, "LED message accepted");
+        zassert_equal(convert_xinput_rumble(rumble, 4, &out), -ENOTSUP, "short message accepted");
+}
+
+ZTEST(pipeline, test_xinput_descriptor)
+{
+        static const struct xinput_descriptor desc = XINPUT_DESCRIPTOR_INIT();
+        const uint8_t *raw = (const uint8_t *)&desc;
+        size_t offset = 0;
+        int endpoints = 0;
+
+        zassert_equal(sizeof(desc), 9 + 17 + 7 + 7, "descriptor has padding");
+        zassert_equal(desc.if0.bInterfaceClass, XINPUT_IF_CLASS, "wrong class");
+        zassert_equal(desc.if0.bInterfaceSubClass, XINPUT_IF_SUBCLASS, "wrong subclass");
+        zassert_equal(desc.if0.bInterfaceProtocol, XINPUT_IF_PROTOCOL, "wrong protocol");
+
+        // the USB stack walks the descriptors by bLength, each one must end where the next begins
+        while (offset < sizeof(desc))
+        {
+                zassert_true(raw[offset] >= 2, "bad bLength at %zu", offset);
+                if (raw[offset + 1] == USB_DESC_ENDPOINT)
+                {
+                        const struct usb_ep_descriptor *ep = (const void *)&raw[offset];
+
+                        zassert_equal(ep->bmAttributes, USB_DC_EP_INTERRUPT, "not an interrupt endpoint");
+                        zassert_true(sys_le16_to_cpu(ep->wMaxPacketSize) >= sizeof(xinputReport_t),
+                                     "endpoint too small for a report");
+                        endpoints++;
+                }
+                offset += raw[offset];
+        }
+        zassert_equal(offset, sizeof(desc), "descriptor lengths do not add up");
+        zassert_equal(endpoints, desc.if0.bNumEndpoints, "endpoint count mismatch");
+
+        zassert_equal(desc.if0_in_ep.bEndpointAddress, XINPUT_EP_IN_ADDR, "IN endpoint");
+        zassert_equal(desc.if0_out_ep.bEndpointAddress, XINPUT_EP_OUT_ADDR, "OUT endpoint");
+        zassert_equal(desc.if0_xinput.bDescriptorType, 0x21, "class descriptor type");
+        zassert_equal(desc.if0_xinput.data[5], sizeof(xinputReport_t), "IN report size");
+        zassert_equal(desc.if0_xinput.data[12], sizeof(xinputRumble_t), "OUT report size");
+        zassert_equal(desc.if0_xinput.data[XINPUT_CLASS_EP_IN], XINPUT_EP_IN_ADDR, "IN endpoint");
+        zassert_equal(desc.if0_xinput.data[XINPUT_CLASS_EP_OUT], XINPUT_EP_OUT_ADDR, "OUT endpoint");
+}
+
+ZTEST(pipeline, test_xinput_descriptor_endpoints)
+{
+        struct xinput_descriptor desc = XINPUT_DESCRIPTOR_INIT();
+
+        // addresses the stack picked instead of the requested ones
+        xinput_descriptor_set_endpoints(&desc, 0x83, 0x02);
+        zassert_equal(desc.if0_xinput.data[XINPUT_CLASS_EP_IN], 0x83, "IN endpoint not updated");
+        zassert_equal(desc.if0_xinput.data[XINPUT_CLASS_EP_OUT], 0x02, "OUT endpoint not updated");
+        zassert_equal(desc.if0_xinput.data[5], sizeof(xinputReport_t), "IN report size changed");
+        zassert_equal(desc.if0_xinput.data[12], sizeof(xinputRumble_t), "OUT report size changed");
+}
+
+ZTEST(pipeline, test_report_filter)
+{
+        struct report_filter filter;
+        struct xbox_controller_report r = neutral;
+
+        report_filter_init(&filter, 128, 2, 100);
+
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 0), REPORT_FILTER_CHANGED,
+                      "first report must pass");
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 1), REPORT_FILTER_DROP,
+                      "duplicate must be dropped");
+
+        r.lstick_y += 100;
+        r.rt = 2;
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 2), REPORT_FILTER_DROP,
+                      "jitter must be dropped");
+
+        r.lstick_y += 100;
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 3), REPORT_FILTER_CHANGED,
+                      "stick movement must pass");
+
+        r.b = 1;
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 4), REPORT_FILTER_CHANGED,
+                      "button press must pass");
+
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 104), REPORT_FILTER_HEARTBEAT,
+                      "heartbeat missing");
+
+        report_filter_reset(&filter);
+        zassert_equal(report_filter_check(&filter, (uint8_t *)&r, 105), REPORT_FILTER_CHANGED,
+                      "report after reset must pass");
+}
+
+ZTEST(pipeline, test_report_is_active)
+{
+        struct xbox_controller_report r = neutral;
+
+        zassert_false(report_is_active(&r, 4096, 32), "neutral report active");
+
+        r.rstick_y -= 4000;
+        r.lt = 30;
+        zassert_false(report_is_active(&r, 4096, 32), "deadzone ignored");
+
+        r.rstick_y -= 1000;
+        zassert_true(report_is_active(&r, 4096, 32), "deflected stick idle");
+
+        r = neutral;
+        r.start = 1;
+        zassert_true(report_is_active(&r, 4096, 32), "held button idle");
+
+        r = neutral;
+        r.dpad.raw = LEFT;
+        zassert_true(report_is_active(&r, 4096, 32), "dpad idle");
+}
+
+ZTEST(pipeline, test_report_ingest)
+{
+        struct xbox_controller_report r = neutral;
+        struct xbox_controller_report published;
+        uint8_t payload[sizeof(r) + 1];
+
+        report_ingest_init(true, 0, 0, 0);
+
+        zassert_equal(report_ingest(payload, sizeof(payload), 0), -EINVAL,
+                      "wrong length accepted");
+
+        // unaligned source buffer as handed out by the BT stack
+        r.x = 1;
+        memcpy(&payload[1], &r, sizeof(r));
+        zassert_equal(report_ingest(&payload[1], sizeof(r), 0), REPORT_FILTER_CHANGED,
+                      "report not published");
+        zassert_ok(zbus_chan_read(&controller_report, &published, K_NO_WAIT), "read failed");
+        zassert_mem_equal(&published, &r, sizeof(r), "published report differs");
+
+        zassert_equal(report_ingest(&payload[1], sizeof(r), 1), REPORT_FILTER_DROP,
+                      "duplicate published");
+        zassert_equal(report_ingest_last_change(), 0, "duplicate counted as a change");
+
+        // without deduplication every notification is published, repeats are still no change
+        report_ingest_init(false, 0, 0, 0);
+        report_ingest(&payload[1], sizeof(r), 2);
+        zassert_equal(report_ingest(&payload[1], sizeof(r), 3), REPORT_FILTER_CHANGED,
+                      "repeat not published");
+        zassert_equal(report_ingest_last_change(), 2, "repeat counted as a change");
+        payload[1] ^= 1;
+        report_ingest(&payload[1], sizeof(r), 4);
+        zassert_equal(report_ingest_last_change(), 4, "change not recorded");
+}
+
+ZTEST(pipeline, test_scan_filter)
+{
+        uint8_t adv[sizeof(adv_controller)];
+
+        zassert_true(scan_filter_match(-40, adv_controller, sizeof(adv_controller)),
+                     "controller not matched");
+        zassert_false(scan_filter_match(-80, adv_controller, sizeof(adv_controller)),
+                      "far away controller matched");
+        zassert_false(scan_filter_match(-40, adv_controller, sizeof(adv_controller) - 1),
+                      "truncated data matched");
+
+        memcpy(adv, adv_controller, sizeof(adv));
+        adv[sizeof(adv) - 1] = 'X';
+        zassert_false(scan_filter_match(-40, adv, sizeof(adv)), "other name matched");
+}
+
+ZTEST(pipeline, test_scan_recv)
+{
+        bt_addr_le_t other = bonded_addr;
+        struct net_buf_simple buf = {
+            .data = (uint8_t *)adv_controller, .len = sizeof(adv_controller)};
+        struct bt_le_scan_recv_info info = {.addr = &other, .rssi = -40};
+
+        other.a.val[0] ^= 1;
+        zassert_false(scan_filter_recv(&info, &buf, false), "connected outside pairing mode");
+        zassert_true(scan_filter_recv(&info, &buf, true), "controller not connected while pairing");
+
+        // a bonded controller reconnects from any distance, whatever it advertises
+        info.addr = &bonded_addr;
+        info.rssi = -90;
+        buf.len = 0;
+        zassert_true(scan_filter_recv(&info, &buf, false), "bonded device not connected");
+}
+
+ZTEST_SUITE(pipeline, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+#include <zephyr/sys/util.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "report_filter.h"
+
+/* the controller notifies once per connection event at the fast interval */
+#define NOTIFY_INTERVAL_US 7500
+#define SEGMENT_MS 10000
+#define STICK_MIDDLE 32767
+
+/*
+ * Tuning targets for the defaults: a resting controller publishes no more
+ * than IDLE_MAX_PER_SEC reports, and the USB report built from the last
+ * published report is never more than one step off the one built from the
+ * notification that was dropped.
+ */
+#define IDLE_MAX_PER_SEC 2
+#define MAX_OUTPUT_STEPS 1
+
+/* keep in sync with the XBOX_CONTROLLER_BLE_DEDUP_* defaults in the library Kconfig */
+#define DEFAULT_STICK_THRESHOLD 256
+#define DEFAULT_TRIGGER_THRESHOLD 4
+#define DEFAULT_HEARTBEAT_MS 500
+
+enum segment
+{
+        SEGMENT_IDLE,
+        SEGMENT_HELD,
+        SEGMENT_ACTIVE,
+        SEGMENT_COUNT,
+};
+
+static const char *const segment_names[] = {"idle", "held", "active"};
+
+struct dedup_result
+{
+        uint32_t received[SEGMENT_COUNT];
+        uint32_t published[SEGMENT_COUNT];
+        uint32_t max_steps;   // largest USB report difference in 8 bit axis steps
+        uint32_t lost_inputs; // button or dpad states that never reached the output
+};
+
+static uint32_t trace_rng;
+
+static int32_t noise(int32_t amplitude)
+{
+        trace_rng = trace_rng * 1103515245 + 12345;
+        return amplitude ? (int32_t)((trace_rng >> 16) % (2 * amplitude + 1)) - amplitude : 0;
+}
+
+static uint16_t axis(int32_t value)
+{
+        return CLAMP(value, 0, 65535);
+}
+
+// full stick travel and back once per second
+static int32_t sweep(uint32_t t_ms)
+{
+        uint32_t phase = t_ms % 1000;
+
+        return (phase < 500) ? phase * 65535 / 500 : (1000 - phase) * 65535 / 500;
+}
+
+/*
+ * Synthetic notification trace, the noise amplitudes are assumptions for a
+ * potentiometer stick, not recordings; no recorded trace is available yet,
+ * so the defaults tuned here are provisional:
+ * - idle: controller on the table, sticks a little off centre with +-96 raw
+ *   units of sensor noise, triggers flickering between 0 and 1
+ * - held: sticks held deflected by hand, +-160 units of tremor, a trigger
+ *   held half way with +-3 units
+ * - active: all stick axes sweeping their full range once per second, a
+ *   trigger pulled every 300 ms, buttons and dpad pressed every 200 ms
+ */
+static void trace_report(uint32_t t_ms, struct xbox_controller_report *r)
+{
+        enum segment segment = t_ms / SEGMENT_MS;
+        uint32_t t = t_ms % SEGMENT_MS;
+
+        memset(r, 0, sizeof(*r));
+        r->dpad.raw = NEUTRAL;
+
+        switch (segment)
+        {
+        case SEGMENT_IDLE:
+                r->lstick_x = axis(STICK_MIDDLE + 600 + noise(96));
+                r->lstick_y = axis(STICK_MIDDLE - 300 + noise(96));
+                r->rstick_x = axis(STICK_MIDDLE + 200 + noise(96));
+                r->rstick_y = axis(STICK_MIDDLE + 450 + noise(96));
+                r->lt = noise(1) > 0;
+                r->rt = noise(1) > 0;
+                break;
+        case SEGMENT_HELD:
+                r->lstick_x = axis(58000 + noise(160));
+                r->lstick_y = axis(20000 + noise(160));
+                r->rstick_x = axis(STICK_MIDDLE + noise(96));
+                r->rstick_y = axis(STICK_MIDDLE + noise(96));
+                r->rt = 512 + noise(3);
+                break;
+        default:
+                r->lstick_x = axis(sweep(t) + noise(160));
+                r->lstick_y = axis(sweep(t + 250) + noise(160));
+                r->rstick_x = axis(sweep(t + 500) + noise(160));
+                r->rstick_y = axis(sweep(t + 750) + noise(160));
+                r->rt = MIN((t % 300) * 1023 / 150, 1023);
+                r->a = (t / 200) & 1;
+                r->dpad.raw = ((t / 200) % 4 == 3) ? LEFT : NEUTRAL;
+                break;
+        }
+}
+
+static uint32_t axis_steps(uint8_t a, uint8_t b)
+{
+        return abs((int)a - (int)b);
+}
+
+static void replay(uint16_t stick_threshold, uint16_t trigger_threshold, uint32_t heartbeat_ms,
+                   struct dedup_result *result)
+{
+        struct report_filter filter;
+        struct xbox_controller_report r;
+        inputReport01_t wanted, got;
+
+        trace_rng = 1;
+        memset(result, 0, sizeof(*result));
+        report_filter_init(&filter, stick_threshold, trigger_threshold, heartbeat_ms);
+
+        for (uint32_t t_us = 0; t_us < SEGMENT_COUNT * SEGMENT_MS * 1000; t_us += NOTIFY_INTERVAL_US)
+        {
+                uint32_t t = t_us / 1000;
+                enum segment segment = t / SEGMENT_MS;
+
+                trace_report(t, &r);
+                result->received[segment]++;
+                if (report_filter_check(&filter, (uint8_t *)&r, t) != REPORT_FILTER_DROP)
+                {
+                        result->published[segment]++;
+                }
+
+                convert_in_report(&r, &wanted);
+                convert_in_report(&filter.last.report, &got);
+
+                result->max_steps = MAX(result->max_steps, axis_steps(wanted.GD_GamePadX, got.GD_GamePadX));
+                result->max_steps = MAX(result->max_steps, axis_steps(wanted.GD_GamePadY, got.GD_GamePadY));
+                result->max_steps = MAX(result->max_steps, axis_steps(wanted.GD_GamePadZ, got.GD_GamePadZ));
+                result->max_steps = MAX(result->max_steps, axis_steps(wanted.GD_GamePadRx, got.GD_GamePadRx));
+                result->max_steps = MAX(result->max_steps, axis_steps(wanted.GD_GamePadRy, got.GD_GamePadRy));
+                result->max_steps = MAX(result->max_steps, axis_steps(wanted.GD_GamePadRz, got.GD_GamePadRz));
+                if ((wanted.BTN_GamePadButton1 != got.BTN_GamePadButton1) ||
+                    (wanted.GD_GamePadHatSwitch != got.GD_GamePadHatSwitch))
+                {
+                        result->lost_inputs++;
+                }
+        }
+}
+
+static uint32_t per_sec(uint32_t count)
+{
+        return count * 1000 / SEGMENT_MS;
+}
+
+static void print_result(const char *name, const struct dedup_result *result)
+{
+        TC_PRINT("%s:", name);
+        for (size_t s = 0; s < SEGMENT_COUNT; s++)
+        {
+                TC_PRINT(" %s %u/s of %u/s (%u %% suppressed)", segment_names[s],
+                         per_sec(result->published[s]), per_sec(result->received[s]),
+                         100 - result->published[s] * 100 / result->received[s]);
+        }
+        TC_PRINT(", max error %u steps\n", result->max_steps);
+}
+
+/* publish rates and worst case output error over a threshold sweep */
+ZTEST(report_filter, test_dedup_replay)
+{
+        static const uint16_t stick_thresholds[] = {0, 64, 128, 192, 256, 384};
+        static const uint16_t trigger_thresholds[] = {0, 1, 2, 4, 6};
+        static const uint32_t heartbeats[] = {0, 100, 250, 500, 1000};
+        struct dedup_result result;
+        char name[48];
+
+        for (size_t i = 0; i < ARRAY_SIZE(stick_thresholds); i++)
+        {
+                snprintf(name, sizeof(name), "stick %u", stick_thresholds[i]);
+                replay(stick_thresholds[i], DEFAULT_TRIGGER_THRESHOLD, 0, &result);
+                print_result(name, &result);
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(trigger_thresholds); i++)
+        {
+                snprintf(name, sizeof(name), "trigger %u", trigger_thresholds[i]);
+                replay(DEFAULT_STICK_THRESHOLD, trigger_thresholds[i], 0, &result);
+                print_result(name, &result);
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(heartbeats); i++)
+        {
+                snprintf(name, sizeof(name), "heartbeat %u ms", heartbeats[i]);
+                replay(DEFAULT_STICK_THRESHOLD, DEFAULT_TRIGGER_THRESHOLD, heartbeats[i], &result);
+                print_result(name, &result);
+        }
+
+        // without a threshold every noisy notification is a change
+        replay(0, 0, 0, &result);
+        zassert_equal(result.max_steps, 0, "exact compare lost a change");
+        zassert_true(per_sec(result.published[SEGMENT_IDLE]) > 100, "trace has no idle noise");
+
+        replay(DEFAULT_STICK_THRESHOLD, DEFAULT_TRIGGER_THRESHOLD, DEFAULT_HEARTBEAT_MS, &result);
+        print_result("defaults", &result);
+
+        zassert_true(per_sec(result.published[SEGMENT_IDLE]) <= IDLE_MAX_PER_SEC,
+                     "idle controller publishes %u reports/s", per_sec(result.published[SEGMENT_IDLE]));
+        zassert_true(result.max_steps <= MAX_OUTPUT_STEPS, "output off by %u steps", result.max_steps);
+        zassert_equal(result.lost_inputs, 0, "button or dpad change suppressed");
+        // motion still goes through at close to the notification rate
+        zassert_true(result.published[SEGMENT_ACTIVE] * 10 >= result.received[SEGMENT_ACTIVE] * 9,
+                     "active input suppressed");
+}
+
+ZTEST_SUITE(report_filter, NULL, NULL, NULL, NULL, NULL);
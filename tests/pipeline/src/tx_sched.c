@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "xbox_controller_ble/report_structs.h"
+#include "ingest.h"
+#include "tx_sched.h"
+
+#define WRITE_HANDLE 0x0042
+#define MAX_WRITES 16
+
+/*
+ * The GATT layer is replaced by a recorder: writes are kept with their
+ * completion callback so the test decides when the controller acknowledges
+ * them, and a write can be made to fail for lack of TX buffers.
+ */
+static struct
+{
+        struct xbox_controller_report_output reports[MAX_WRITES];
+        bt_gatt_complete_func_t done[MAX_WRITES];
+        uint32_t count;
+        uint32_t completed;
+        int fail_next;
+} writes;
+
+/* never dereferenced, the scheduler only passes it back to the GATT layer */
+static uint8_t conn_storage[4];
+#define CONN ((struct bt_conn *)conn_storage)
+
+struct bt_conn *bt_conn_ref(struct bt_conn *conn)
+{
+        return conn;
+}
+
+void bt_conn_unref(struct bt_conn *conn)
+{
+}
+
+int bt_gatt_write_without_response_cb(struct bt_conn *conn, uint16_t handle, const void *data,
+                                      uint16_t length, bool sign, bt_gatt_complete_func_t func,
+                                      void *user_data)
+{
+        zassert_equal(conn, CONN, "wrong connection");
+        zassert_equal(handle, WRITE_HANDLE, "wrong handle");
+        zassert_equal(length, sizeof(struct xbox_controller_report_output), "wrong length");
+
+        if (writes.fail_next)
+        {
+                int err = writes.fail_next;
+
+                writes.fail_next = 0;
+                return err;
+        }
+
+        zassert_true(writes.count < MAX_WRITES, "too many writes");
+        memcpy(&writes.reports[writes.count], data, length);
+        writes.done[writes.count] = func;
+        writes.count++;
+
+        return 0;
+}
+
+// the controller acknowledged the oldest outstanding write
+static void complete_write(void)
+{
+        zassert_true(writes.completed < writes.count, "nothing in flight");
+        writes.done[writes.completed](CONN, NULL);
+        writes.completed++;
+}
+
+static int queue_rumble(uint8_t level)
+{
+        struct xbox_controller_report_output r = {0};
+
+        r.DcEnableActuators = 0x3;
+        r.Magnitude[2] = level;
+        r.Duration = 10;
+
+        return request_rumble(&r);
+}
+
+// let the system work queue run the scheduler
+static void settle(void)
+{
+        k_msleep(1);
+}
+
+ZTEST(tx_sched, test_one_write_per_event)
+{
+        for (uint8_t i = 1; i <= 3; i++)
+        {
+                zassert_equal(queue_rumble(i), 0, "request refused");
+        }
+        settle();
+        zassert_equal(writes.count, 0, "written without a connection event");
+
+        tx_sched_on_notify(0);
+        settle();
+        zassert_equal(writes.count, CONFIG_XBOX_CONTROLLER_BLE_TX_PER_EVENT, "budget not applied");
+        zassert_equal(writes.reports[0].Magnitude[2], 1, "written out of order");
+
+        tx_sched_on_notify(7500);
+        settle();
+        zassert_equal(writes.count, 2, "second event not used");
+
+        // MAX_IN_FLIGHT writes are outstanding, the next event has to wait
+        tx_sched_on_notify(7500);
+        settle();
+        zassert_equal(writes.count, CONFIG_XBOX_CONTROLLER_BLE_TX_MAX_IN_FLIGHT, "in flight limit");
+
+        // an acknowledgement uses the budget left from that event
+        complete_write();
+        settle();
+        zassert_equal(writes.count, 3, "write not sent after acknowledgement");
+        zassert_equal(writes.reports[2].Magnitude[2], 3, "written out of order");
+        zassert_equal(xbox_ble_stats.tx_writes, 3, "writes not counted");
+        zassert_equal(xbox_ble_stats.tx_queue_depth, 0, "queue not drained");
+}
+
+ZTEST(tx_sched, test_backpressure)
+{
+        for (uint8_t i = 0; i < CONFIG_XBOX_CONTROLLER_BLE_TX_QUEUE_DEPTH; i++)
+        {
+                zassert_equal(queue_rumble(i), 0, "request refused");
+        }
+
+        zassert_true(rumble_queue_full(), "queue not full");
+        zassert_equal(queue_rumble(100), -EAGAIN, "full queue accepted a request");
+        zassert_equal(xbox_ble_stats.tx_backpressure, 1, "refusal not counted");
+        zassert_equal(xbox_ble_stats.tx_queue_peak, CONFIG_XBOX_CONTROLLER_BLE_TX_QUEUE_DEPTH,
+                      "peak depth");
+
+        tx_sched_on_notify(0);
+        settle();
+        zassert_false(rumble_queue_full(), "queue not drained");
+}
+
+ZTEST(tx_sched, test_fallback_without_input)
+{
+        zassert_equal(queue_rumble(50), 0, "request refused");
+
+        k_msleep(CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS / 2);
+        zassert_equal(writes.count, 0, "written before the fallback timeout");
+
+        k_msleep(CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS);
+        zassert_equal(writes.count, 1, "fallback timer did not send");
+}
+
+ZTEST(tx_sched, test_retry_without_buffers)
+{
+        zassert_equal(queue_rumble(50), 0, "request refused");
+
+        writes.fail_next = -ENOBUFS;
+        tx_sched_on_notify(0);
+        settle();
+        zassert_equal(writes.count, 0, "write recorded although it failed");
+        zassert_equal(xbox_ble_stats.tx_queue_depth, 1, "report dropped on -ENOBUFS");
+
+        tx_sched_on_notify(7500);
+        settle();
+        zassert_equal(writes.count, 1, "report not retried");
+        zassert_equal(writes.reports[0].Magnitude[2], 50, "wrong report retried");
+}
+
+ZTEST(tx_sched, test_stop)
+{
+        zassert_equal(queue_rumble(50), 0, "request refused");
+
+        tx_sched_stop();
+        zassert_equal(xbox_ble_stats.tx_queue_depth, 0, "queue kept after stop");
+        zassert_equal(queue_rumble(50), -EIO, "request accepted without a link");
+
+        tx_sched_on_notify(0);
+        k_msleep(2 * CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS);
+        zassert_equal(writes.count, 0, "written after stop");
+}
+
+static void tx_sched_before(void *fixture)
+{
+        tx_sched_stop();
+        memset(&writes, 0, sizeof(writes));
+        memset(&xbox_ble_stats, 0, sizeof(xbox_ble_stats));
+        tx_sched_start(CONN, WRITE_HANDLE);
+        tx_sched_set_interval(7500);
+        // start every test well past the fallback timeout of the previous one
+        k_msleep(2 * CONFIG_XBOX_CONTROLLER_BLE_TX_FALLBACK_MS);
+}
+
+ZTEST_SUITE(tx_sched, NULL, NULL, tx_sched_before, NULL, NULL);
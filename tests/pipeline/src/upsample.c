@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2023 Maximilian Deubel
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/ztest.h>
+
+#include "xbox_controller_ble/upsample.h"
+
+/* BLE connection interval of the replayed trace and length of the trace */
+#define BLE_INTERVAL_US 7500
+#define USB_INTERVAL_US 1000
+#define TRACE_US 3000000
+
+struct replay_result
+{
+        uint32_t mean_error;
+        uint32_t max_error;
+        bool buttons_predicted;
+};
+
+/* ground truth: a triangle sweep on the left stick with a flick and a hold */
+static uint16_t truth_stick(uint32_t t_us)
+{
+        uint32_t t = t_us % 600000;
+
+        if (t < 300000)
+        {
+                return 2767 + t / 5;
+        }
+        if (t < 400000)
+        {
+                return 62767;
+        }
+        if (t < 420000)
+        {
+                return 62767 - (t - 400000) * 3;
+        }
+        return 2767;
+}
+
+static uint16_t truth_trigger(uint32_t t_us)
+{
+        return (t_us / 1000) % 1024;
+}
+
+static void truth_report(uint32_t t_us, struct xbox_controller_report *r)
+{
+        memset(r, 0, sizeof(*r));
+        r->lstick_x = truth_stick(t_us);
+        r->lstick_y = 32767;
+        r->rstick_x = 32767;
+        r->rstick_y = 32767;
+        r->lt = truth_trigger(t_us);
+        r->a = (t_us / 100000) & 1;
+}
+
+/* replay the trace: BLE samples at the connection interval, USB reports every ms */
+static void replay(enum upsample_mode mode, uint16_t alpha, struct replay_result *result)
+{
+        struct upsample upsample;
+        struct xbox_controller_report sample, estimate;
+        uint64_t error_sum = 0;
+        uint32_t count = 0;
+
+        upsample_init(&upsample, mode, alpha);
+        memset(result, 0, sizeof(*result));
+
+        for (uint32_t t = 0; t < TRACE_US; t += USB_INTERVAL_US)
+        {
+                if ((t % BLE_INTERVAL_US) < USB_INTERVAL_US)
+                {
+                        truth_report(t - (t % BLE_INTERVAL_US), &sample);
+                        upsample_push(&upsample, &sample, t);
+                }
+
+                upsample_get(&upsample, t, &estimate);
+
+                uint32_t error = abs((int32_t)estimate.lstick_x - truth_stick(t));
+
+                error_sum += error;
+                result->max_error = MAX(result->max_error, error);
+                count++;
+
+                if ((estimate.a != sample.a) || (estimate.dpad.raw != sample.dpad.raw))
+                {
+                        result->buttons_predicted = true;
+                }
+                zassert_true(estimate.lt <= 1023, "trigger out of range");
+        }
+
+        result->mean_error = error_sum / count;
+}
+
+static void replay_and_print(const char *name, enum upsample_mode mode, uint16_t alpha,
+                             struct replay_result *result)
+{
+        replay(mode, alpha, result);
+        TC_PRINT("upsample %s: mean error %u, max error %u\n", name,
+                 result->mean_error, result->max_error);
+        zassert_false(result->buttons_predicted, "%s predicted buttons", name);
+}
+
+ZTEST(upsample_replay, test_replay_error)
+{
+        struct replay_result hold, linear, filter;
+
+        replay_and_print("hold", UPSAMPLE_HOLD, 0, &hold);
+        replay_and_print("linear", UPSAMPLE_LINEAR, 0, &linear);
+        replay_and_print("filter", UPSAMPLE_FILTER, 128, &filter);
+
+        zassert_true(linear.mean_error < hold.mean_error, "linear worse than hold");
+        zassert_true(filter.mean_error < hold.mean_error, "filter worse than hold");
+}
+
+ZTEST(upsample_replay, test_extrapolation_clamped)
+{
+        struct upsample upsample;
+        struct xbox_controller_report r = {0}, estimate;
+
+        upsample_init(&upsample, UPSAMPLE_LINEAR, 0);
+
+        r.lstick_x = 60000;
+        r.rt = 900;
+        upsample_push(&upsample, &r, 0);
+        r.lstick_x = 65000;
+        r.rt = 1000;
+        upsample_push(&upsample, &r, 7500);
+
+        upsample_get(&upsample, 7500 + 7000, &estimate);
+        zassert_equal(estimate.lstick_x, 65535, "stick not clamped");
+        zassert_equal(estimate.rt, 1023, "trigger not clamped");
+
+        // overdue sample: fall back to the last one instead of drifting
+        upsample_get(&upsample, 7500 + 9000, &estimate);
+        zassert_equal(estimate.lstick_x, 65000, "stale estimate extrapolated");
+}
+
+ZTEST_SUITE(upsample_replay, NULL, NULL, NULL, NULL, NULL);